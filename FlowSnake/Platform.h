@@ -0,0 +1,69 @@
+#pragma once
+
+// Everything the simulation needs from the OS lives here, so Simulation.cpp builds
+// the same on Windows (MSVC) and on our Linux server boxes (gcc/clang).
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX // Windows.h min/max macros break <algorithm>, <thread>, ...
+#	include <Windows.h>
+#else
+#	include <stdint.h>
+#	include <time.h>   // clock_gettime
+#	include <stdio.h>  // fprintf
+#	include <stdlib.h> // abort
+
+typedef int32_t HRESULT;
+typedef unsigned int UINT;
+
+#	define S_OK		((HRESULT)0x00000000L)
+#	define S_FALSE	((HRESULT)0x00000001L)
+#	define E_FAIL	((HRESULT)0x80004005L)
+#	define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#	define FAILED(hr)	  (((HRESULT)(hr)) < 0)
+#endif
+
+typedef UINT uint;
+typedef unsigned short ushort;
+typedef unsigned long long uint64;
+
+/********** Defines *******************************/
+#define countof(x) (sizeof(x)/sizeof(x[0]))
+#ifdef _DEBUG
+#	ifdef _WIN32
+#		define IFC(x) { if (FAILED(hr = x)) { char buf[256]; sprintf_s(buf, "IFC Failed at Line %u\n", __LINE__); OutputDebugString(buf); goto Cleanup; } }
+#		define ASSERT(x) if (!(x)) { OutputDebugString("Assert Failed!\n"); DebugBreak(); }
+#	else
+#		define IFC(x) { if (FAILED(hr = x)) { fprintf(stderr, "IFC Failed at Line %u\n", __LINE__); goto Cleanup; } }
+#		define ASSERT(x) if (!(x)) { fprintf(stderr, "Assert Failed! %s:%u\n", __FILE__, __LINE__); abort(); }
+#	endif
+#else
+#	define IFC(x) {if (FAILED(hr = x)) { goto Cleanup; }}
+#	define ASSERT(x)
+#endif
+
+/********** Timing ********************************/
+// High resolution tick counter. Divide tick deltas by GetTickFrequency() for seconds.
+inline uint64 GetTicks()
+{
+#ifdef _WIN32
+	LARGE_INTEGER ticks;
+	QueryPerformanceCounter(&ticks);
+	return ticks.QuadPart;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+inline uint64 GetTickFrequency()
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return freq.QuadPart;
+#else
+	return 1000000000ull;
+#endif
+}
@@ -0,0 +1,235 @@
+#include "Profiler.h"
+#include <string.h> // memset
+#if defined(_MSC_VER)
+#	include <intrin.h> // _BitScanReverse
+#endif
+#ifdef __linux__
+#	include <linux/perf_event.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+PhaseTimer g_phaseTimers[PHASE_COUNT];
+PhaseHistogram g_phaseHistograms[PHASE_COUNT];
+uint64 g_frameCounters[COUNTER_COUNT];
+
+struct CounterTotals
+{
+	uint64 total;
+	uint frames; // Frames the counter went up in
+	uint64 max;	 // Most in one frame
+};
+static CounterTotals s_counterTotals[COUNTER_COUNT];
+static int s_cacheMissCounter = -1;
+
+static const char* s_phaseNames[PHASE_COUNT] =
+{
+	"Update",
+	"Binning",
+	"Nearest Neighbor",
+	"Fallback Search",
+	"Position Update",
+	"Chain Order",
+	"Endgame",
+	"Replication Encode",
+	"Replication Decode",
+	"Record Keyframe",
+};
+
+static const char* s_counterNames[COUNTER_COUNT] =
+{
+	"Fallback Searches",
+	"Replication Bytes",
+};
+
+// Index of the most significant set bit. v must be nonzero.
+static uint HighestBit(uint64 v)
+{
+#if defined(_MSC_VER)
+	unsigned long bit;
+	if (_BitScanReverse(&bit, uint(v >> 32)))
+		return bit + 32;
+	_BitScanReverse(&bit, uint(v));
+	return bit;
+#else
+	return 63 - __builtin_clzll(v);
+#endif
+}
+
+// Values below PROFILE_SUB_BUCKETS get a bucket each, above that every power of two
+// is split into PROFILE_SUB_BUCKETS linear sub-buckets using the bits below the top one
+static uint BucketIndex(uint64 ticks)
+{
+	if (ticks < PROFILE_SUB_BUCKETS)
+		return uint(ticks);
+
+	uint exponent = HighestBit(ticks);
+	uint mantissa = uint(ticks >> (exponent - PROFILE_SUB_BUCKET_BITS)) & (PROFILE_SUB_BUCKETS - 1);
+	return (exponent - PROFILE_SUB_BUCKET_BITS + 1) * PROFILE_SUB_BUCKETS + mantissa;
+}
+
+// Largest tick count that lands in the bucket
+static uint64 BucketUpperBound(uint index)
+{
+	if (index < PROFILE_SUB_BUCKETS)
+		return index;
+
+	uint exponent = index / PROFILE_SUB_BUCKETS + PROFILE_SUB_BUCKET_BITS - 1;
+	uint64 mantissa = PROFILE_SUB_BUCKETS + index % PROFILE_SUB_BUCKETS;
+	return ((mantissa + 1) << (exponent - PROFILE_SUB_BUCKET_BITS)) - 1;
+}
+
+static void RecordSample(PhaseHistogram& histogram, uint64 ticks)
+{
+	histogram.buckets[BucketIndex(ticks)]++;
+	histogram.count++;
+	histogram.totalTicks += ticks;
+	if (ticks > histogram.maxTicks)
+		histogram.maxTicks = ticks;
+}
+
+void EndProfileFrame()
+{
+	for (uint i = 0; i < PHASE_COUNT; i++)
+	{
+		PhaseTimer& timer = g_phaseTimers[i];
+		if (timer.touched)
+			RecordSample(g_phaseHistograms[i], timer.frameTicks);
+
+		timer.frameTicks = 0;
+		timer.touched = false;
+	}
+
+	for (uint i = 0; i < COUNTER_COUNT; i++)
+	{
+		CounterTotals& totals = s_counterTotals[i];
+		if (g_frameCounters[i])
+		{
+			totals.total += g_frameCounters[i];
+			totals.frames++;
+			if (g_frameCounters[i] > totals.max)
+				totals.max = g_frameCounters[i];
+		}
+		g_frameCounters[i] = 0;
+	}
+}
+
+void ResetProfiler()
+{
+	memset(g_phaseTimers, 0, sizeof(g_phaseTimers));
+	memset(g_phaseHistograms, 0, sizeof(g_phaseHistograms));
+	memset(g_frameCounters, 0, sizeof(g_frameCounters));
+	memset(s_counterTotals, 0, sizeof(s_counterTotals));
+}
+
+const char* GetPhaseName(ProfilePhase phase)
+{
+	return s_phaseNames[phase];
+}
+
+const char* GetCounterName(ProfileCounter counter)
+{
+	return s_counterNames[counter];
+}
+
+uint64 GetCounterTotal(ProfileCounter counter)
+{
+	return s_counterTotals[counter].total;
+}
+
+// The bucket holding the q-th quantile sample, reported as the bucket's upper bound (never above the true max)
+static uint64 Quantile(const PhaseHistogram& histogram, double q)
+{
+	uint64 rank = uint64(q * histogram.count + 0.5);
+	if (rank < 1) rank = 1;
+
+	uint64 seen = 0;
+	for (uint i = 0; i < PROFILE_NUM_BUCKETS; i++)
+	{
+		seen += histogram.buckets[i];
+		if (seen >= rank)
+		{
+			uint64 bound = BucketUpperBound(i);
+			return bound < histogram.maxTicks ? bound : histogram.maxTicks;
+		}
+	}
+	return histogram.maxTicks;
+}
+
+void GetPhaseStats(ProfilePhase phase, PhaseStats* stats)
+{
+	const PhaseHistogram& histogram = g_phaseHistograms[phase];
+	double msPerTick = 1000.0 / GetTickFrequency();
+
+	memset(stats, 0, sizeof(*stats));
+	stats->samples = histogram.count;
+	if (histogram.count == 0)
+		return;
+
+	stats->mean = double(histogram.totalTicks) / histogram.count * msPerTick;
+	stats->p50 = Quantile(histogram, 0.50) * msPerTick;
+	stats->p99 = Quantile(histogram, 0.99) * msPerTick;
+	stats->max = histogram.maxTicks * msPerTick;
+}
+
+void PrintProfile(FILE* file, const char* title)
+{
+	fprintf(file, "------------- %s ---------------------\n", title);
+	fprintf(file, "%-18s %8s %9s %9s %9s %9s\n", "Phase (ms)", "samples", "mean", "p50", "p99", "max");
+	for (uint i = 0; i < PHASE_COUNT; i++)
+	{
+		PhaseStats stats;
+		GetPhaseStats(ProfilePhase(i), &stats);
+		if (stats.samples == 0)
+			continue;
+
+		fprintf(file, "%-18s %8u %9.3f %9.3f %9.3f %9.3f\n", GetPhaseName(ProfilePhase(i)),
+				stats.samples, stats.mean, stats.p50, stats.p99, stats.max);
+	}
+
+	fprintf(file, "%-18s %8s %9s %9s\n", "Counter", "frames", "total", "max");
+	for (uint i = 0; i < COUNTER_COUNT; i++)
+	{
+		const CounterTotals& totals = s_counterTotals[i];
+		fprintf(file, "%-18s %8u %9llu %9llu\n", GetCounterName(ProfileCounter(i)), totals.frames,
+				(unsigned long long)totals.total, (unsigned long long)totals.max);
+	}
+}
+
+HRESULT OpenCacheMissCounter()
+{
+	CloseCacheMissCounter();
+#ifdef __linux__
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.exclude_kernel = 1; // Allowed without privileges
+	attr.exclude_hv = 1;
+
+	s_cacheMissCounter = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+	if (s_cacheMissCounter >= 0)
+		return S_OK;
+#endif
+	return E_FAIL;
+}
+
+uint64 ReadCacheMisses()
+{
+	uint64 misses = 0;
+#ifdef __linux__
+	if (s_cacheMissCounter >= 0 && read(s_cacheMissCounter, &misses, sizeof(misses)) != sizeof(misses))
+		misses = 0;
+#endif
+	return misses;
+}
+
+void CloseCacheMissCounter()
+{
+#ifdef __linux__
+	if (s_cacheMissCounter >= 0)
+		close(s_cacheMissCounter);
+#endif
+	s_cacheMissCounter = -1;
+}
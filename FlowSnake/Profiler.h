@@ -0,0 +1,100 @@
+#pragma once
+
+// Always-on phase profiler.
+// Each Update() phase is timed with GetTicks() (QueryPerformanceCounter / CLOCK_MONOTONIC) and the
+// per-frame total of every phase goes into a fixed-size log-linear histogram, so we can report
+// p50/p99/max instead of just averages. Our 60 Hz problem is the tail frames.
+//
+// Not thread safe: Begin/EndPhase and EndProfileFrame must be called from the thread driving Update().
+
+#include "Platform.h"
+#include <stdio.h> // FILE
+
+enum ProfilePhase
+{
+	PHASE_UPDATE,			// The whole Update() call
+	PHASE_BINNING,			// Sorting tails into bins
+	PHASE_NEAREST_NEIGHBOR, // FindNearestNeighbor for every head
+	PHASE_FALLBACK_SEARCH,	// Heads the grid search couldn't help, searched over every tail (inside NEAREST_NEIGHBOR)
+	PHASE_POSITION_UPDATE,	// Chase/follow step and chomps
+	PHASE_CHAIN_ORDER,		// Keeping snakes contiguous in storage (g_chainOrder)
+	PHASE_ENDGAME,			// Explosion
+	PHASE_REPLICATION_ENCODE, // EncodeReplication (Replication.h), outside Update(). Counted with the next frame.
+	PHASE_REPLICATION_DECODE, // DecodeReplication, same
+	PHASE_RECORD_KEYFRAME,	  // Saving a keyframe in RecordTick (Recording.h), outside Update(). Same.
+	PHASE_COUNT
+};
+
+// Events counted per frame, reported next to the phases
+enum ProfileCounter
+{
+	COUNTER_FALLBACK_SEARCHES, // Heads that needed the fallback search
+	COUNTER_REPLICATION_BYTES, // Size of the replication packets
+	COUNTER_COUNT
+};
+
+// 8 sub-buckets per power of two keeps every bucket within 12.5% of its value.
+// 496 buckets covers the full 64-bit tick range.
+#define PROFILE_SUB_BUCKET_BITS 3
+#define PROFILE_SUB_BUCKETS (1 << PROFILE_SUB_BUCKET_BITS)
+#define PROFILE_NUM_BUCKETS ((64 - PROFILE_SUB_BUCKET_BITS + 1) * PROFILE_SUB_BUCKETS)
+
+struct PhaseHistogram
+{
+	uint buckets[PROFILE_NUM_BUCKETS];
+	uint count;
+	uint64 totalTicks;
+	uint64 maxTicks;
+};
+
+struct PhaseStats
+{
+	uint samples;
+	double mean; // All in milliseconds
+	double p50;
+	double p99;
+	double max;
+};
+
+struct PhaseTimer
+{
+	uint64 start;
+	uint64 frameTicks; // Accumulated over the frame, a phase can run several times per Update()
+	bool touched;
+};
+
+extern PhaseTimer g_phaseTimers[PHASE_COUNT];
+extern uint64 g_frameCounters[COUNTER_COUNT];
+
+inline void BeginPhase(ProfilePhase phase)
+{
+	g_phaseTimers[phase].start = GetTicks();
+}
+
+inline void EndPhase(ProfilePhase phase)
+{
+	PhaseTimer& timer = g_phaseTimers[phase];
+	timer.frameTicks += GetTicks() - timer.start;
+	timer.touched = true;
+}
+
+inline void AddToCounter(ProfileCounter counter, uint64 amount)
+{
+	g_frameCounters[counter] += amount;
+}
+
+// Push this frame's phase and counter totals into the histograms. Called once at the end of every Update().
+void EndProfileFrame();
+void ResetProfiler();
+
+const char* GetPhaseName(ProfilePhase phase);
+const char* GetCounterName(ProfileCounter counter);
+uint64 GetCounterTotal(ProfileCounter counter);
+void GetPhaseStats(ProfilePhase phase, PhaseStats* stats);
+void PrintProfile(FILE* file, const char* title);
+
+// Hardware cache miss counter (Linux perf events). It only counts the calling thread, so measure with
+// one worker. Open fails where the OS or the machine (VMs often) doesn't expose the counter.
+HRESULT OpenCacheMissCounter();
+uint64 ReadCacheMisses(); // Since the counter was opened
+void CloseCacheMissCounter();
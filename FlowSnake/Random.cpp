@@ -0,0 +1,48 @@
+#include "Random.h"
+#include "Simd.h"
+
+void RandomPairs(uint seed, uint stream, uint first, uint count, float* x, float* y)
+{
+	uint i = 0;
+	for (; i + UINTV_WIDTH <= count; i += UINTV_WIDTH)
+	{
+		// Philox, like the scalar one, on UINTV_WIDTH consecutive indexes
+		uintv counter0 = AddU(SetU(first + i), LaneIndexes());
+		uintv counter1 = SetU(stream);
+		uint key = seed;
+		for (uint round = 0; round < PHILOX_ROUNDS; round++)
+		{
+			uintv hi;
+			uintv lo = MulHiLo(counter0, PHILOX_M, &hi);
+			counter0 = XorU(XorU(hi, SetU(key)), counter1);
+			counter1 = lo;
+			key += PHILOX_W;
+		}
+
+		StoreUnitFloats(x + i, counter0);
+		StoreUnitFloats(y + i, counter1);
+	}
+
+	for (; i < count; i++)
+		RandomPair(seed, stream, first + i, &x[i], &y[i]);
+}
+
+void HashPairs(uint key, uint first, uint count, float* x, float* y)
+{
+	uint i = 0;
+	for (; i + UINTV_WIDTH <= count; i += UINTV_WIDTH)
+	{
+		uintv h = XorU(AddU(SetU(first + i), LaneIndexes()), SetU(key));
+		h = XorU(h, ShiftRightU(h, 16));
+		h = MulLo(h, HASH_M0);
+		h = XorU(h, ShiftRightU(h, 15));
+		h = MulLo(h, HASH_M1);
+		h = XorU(h, ShiftRightU(h, 16));
+
+		StoreUnitFloats(x + i, AndU(h, SetU(0xFFFF0000)));
+		StoreUnitFloats(y + i, ShiftLeftU(h, 16));
+	}
+
+	for (; i < count; i++)
+		HashPair(key, first + i, &x[i], &y[i]);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// Counter based random numbers: Philox2x32-10, from Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3".
+// Every number is a pure function of (seed, stream, index) with no state in between, so any thread can make
+// any part of a sequence, in any order, and get the same numbers. RandomPairs makes UINTV_WIDTH at a time
+// with the same results as RandomPair.
+
+#include "Platform.h"
+
+#define PHILOX_ROUNDS 10
+#define PHILOX_M 0xD256D193 // Round multiplier
+#define PHILOX_W 0x9E3779B9 // Key schedule increment (golden ratio)
+
+// Streams keep subsystems from reusing each other's numbers. The round gives every explosion of a world
+// numbers of its own (the simulation counts them from the world's start), and worlds always use round 0.
+enum RandomStreamId
+{
+	RANDOM_WORLD,	  // Starting positions
+	RANDOM_EXPLOSION, // Explosion velocities
+	RANDOM_TEST,	  // Test.cpp's own worlds
+	RANDOM_STREAM_COUNT
+};
+
+inline uint RandomStream(RandomStreamId id, uint round)
+{
+	return round * RANDOM_STREAM_COUNT + id;
+}
+
+struct RandomBits
+{
+	uint x;
+	uint y;
+};
+
+// 64 random bits for counter (index, stream) under key seed
+inline RandomBits Philox(uint seed, uint stream, uint index)
+{
+	uint counter0 = index;
+	uint counter1 = stream;
+	uint key = seed;
+	for (uint round = 0; round < PHILOX_ROUNDS; round++)
+	{
+		uint64 product = uint64(counter0) * PHILOX_M;
+		counter0 = uint(product >> 32) ^ key ^ counter1;
+		counter1 = uint(product);
+		key += PHILOX_W;
+	}
+
+	RandomBits bits = {counter0, counter1};
+	return bits;
+}
+
+// The top 24 bits as a float in [0, 1). Every value is exact.
+inline float UnitFloat(uint bits)
+{
+	return float(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// Two floats in [0, 1) for one index, say a position or a velocity
+inline void RandomPair(uint seed, uint stream, uint index, float* x, float* y)
+{
+	RandomBits bits = Philox(seed, stream, index);
+	*x = UnitFloat(bits.x);
+	*y = UnitFloat(bits.y);
+}
+
+// RandomPair(seed, stream, first + i, &x[i], &y[i]) for every i in [0, count)
+void RandomPairs(uint seed, uint stream, uint first, uint count, float* x, float* y);
+
+// For numbers that are needed again every frame and are cheaper to remake than to store: Chris Wellons'
+// lowbias32 hash of index ^ key, two multiplies instead of Philox's ten. Take the key from Philox.
+#define HASH_M0 0x7FEB352D
+#define HASH_M1 0x846CA68B
+
+inline uint RandomHash(uint key, uint index)
+{
+	uint h = index ^ key;
+	h ^= h >> 16;
+	h *= HASH_M0;
+	h ^= h >> 15;
+	h *= HASH_M1;
+	h ^= h >> 16;
+	return h;
+}
+
+// Two floats in [0, 1) with 16 bits each, from one hash
+inline void HashPair(uint key, uint index, float* x, float* y)
+{
+	uint h = RandomHash(key, index);
+	*x = UnitFloat(h & 0xFFFF0000);
+	*y = UnitFloat(h << 16);
+}
+
+// HashPair(key, first + i, &x[i], &y[i]) for every i in [0, count)
+void HashPairs(uint key, uint first, uint count, float* x, float* y);
@@ -0,0 +1,361 @@
+#include "Recording.h"
+#include "Profiler.h"
+#include "WorkerPool.h"
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifndef _WIN32
+#	include <fcntl.h>	  // open
+#	include <sys/mman.h> // mmap
+#	include <sys/stat.h> // fstat
+#	include <unistd.h>	  // close
+#endif
+
+// Leads every block, the state follows
+struct KeyframeHeader
+{
+	uint tick;
+	uint reserved;
+	uint64 checksum; // StateChecksum() of the state in this block
+};
+
+// The state is padded so the dts after it stay aligned
+inline uint KeyframeBytes(uint stateSize)
+{
+	return sizeof(KeyframeHeader) + ((stateSize + 7) & ~7u);
+}
+
+inline uint BlockBytes(uint stateSize, uint numTicks)
+{
+	return KeyframeBytes(stateSize) + numTicks * sizeof(double);
+}
+
+/********** Recording *****************************/
+static FILE* s_file = nullptr;
+static RecordingHeader s_header;
+static unsigned char* s_blocks[2]; // RecordTick fills one while the writer writes the other
+static uint s_fillBlock = 0;
+static uint s_ticksInBlock = 0;
+
+static std::thread s_writer;
+static std::mutex s_mutex;
+static std::condition_variable s_wake;	  // The writer waits here for a block
+static std::condition_variable s_written; // SubmitBlock waits here for the writer
+static const unsigned char* s_pending = nullptr; // Block waiting to be written
+static uint s_pendingSize = 0;
+static bool s_quit = false;
+static bool s_writeFailed = false;
+
+static void WriterMain()
+{
+	for (;;)
+	{
+		const unsigned char* block;
+		uint size;
+		{
+			std::unique_lock<std::mutex> lock(s_mutex);
+			while (!s_quit && s_pending == nullptr)
+				s_wake.wait(lock);
+			if (s_pending == nullptr)
+				return; // Quitting, and everything's written
+			block = s_pending;
+			size = s_pendingSize;
+		}
+
+		bool written = fwrite(block, 1, size, s_file) == size;
+
+		{
+			std::lock_guard<std::mutex> lock(s_mutex);
+			if (!written)
+				s_writeFailed = true;
+			s_pending = nullptr;
+		}
+		s_written.notify_all();
+	}
+}
+
+// Hand the block being filled to the writer and start on the other one, once the writer is done with it
+static void SubmitBlock(uint size)
+{
+	{
+		std::unique_lock<std::mutex> lock(s_mutex);
+		while (s_pending != nullptr)
+			s_written.wait(lock);
+		s_pending = s_blocks[s_fillBlock];
+		s_pendingSize = size;
+	}
+	s_wake.notify_all();
+
+	s_fillBlock ^= 1;
+	s_ticksInBlock = 0;
+}
+
+static FILE* OpenFile(const char* path, const char* mode)
+{
+#ifdef _WIN32
+	FILE* file = nullptr;
+	return fopen_s(&file, path, mode) == 0 ? file : nullptr;
+#else
+	return fopen(path, mode);
+#endif
+}
+
+HRESULT BeginRecording(const char* path, uint keyframeInterval)
+{
+	if (s_file || keyframeInterval == 0)
+		return E_FAIL;
+
+	memset(&s_header, 0, sizeof(s_header));
+	memcpy(s_header.magic, RECORDING_MAGIC, sizeof(s_header.magic));
+	s_header.version = RECORDING_VERSION;
+	s_header.numNodes = g_numNodes;
+	s_header.nodeIndexBytes = sizeof(NodeIndex);
+	s_header.stateSize = SimulationStateSize();
+	s_header.keyframeInterval = keyframeInterval;
+	s_header.numThreads = GetWorkerCount();
+
+	s_file = OpenFile(path, "wb");
+	if (s_file == nullptr)
+		return E_FAIL;
+
+	// numTicks and the final checksum get filled in at the end
+	if (fwrite(&s_header, sizeof(s_header), 1, s_file) != 1)
+	{
+		fclose(s_file);
+		s_file = nullptr;
+		return E_FAIL;
+	}
+
+	uint blockSize = BlockBytes(s_header.stateSize, keyframeInterval);
+	for (uint i = 0; i < 2; i++)
+	{
+		s_blocks[i] = new unsigned char[blockSize];
+		memset(s_blocks[i], 0, blockSize); // Padding included, so recordings of the same run are identical
+	}
+	s_fillBlock = 0;
+	s_ticksInBlock = 0;
+	s_pending = nullptr;
+	s_quit = false;
+	s_writeFailed = false;
+	s_writer = std::thread(WriterMain);
+
+	return S_OK;
+}
+
+HRESULT RecordTick(double deltaTime)
+{
+	if (s_file == nullptr)
+		return E_FAIL;
+
+	unsigned char* block = s_blocks[s_fillBlock];
+	if (s_ticksInBlock == 0)
+	{
+		BeginPhase(PHASE_RECORD_KEYFRAME);
+		KeyframeHeader* keyframe = (KeyframeHeader*)block;
+		keyframe->tick = s_header.numTicks;
+		keyframe->checksum = StateChecksum();
+		SaveSimulationState(keyframe + 1);
+		EndPhase(PHASE_RECORD_KEYFRAME);
+	}
+
+	double* deltaTimes = (double*)(block + KeyframeBytes(s_header.stateSize));
+	deltaTimes[s_ticksInBlock++] = deltaTime;
+	s_header.numTicks++;
+
+	if (s_ticksInBlock == s_header.keyframeInterval)
+		SubmitBlock(BlockBytes(s_header.stateSize, s_ticksInBlock));
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return s_writeFailed ? E_FAIL : S_OK;
+}
+
+HRESULT EndRecording()
+{
+	HRESULT hr = S_OK;
+
+	if (s_file == nullptr)
+		return E_FAIL;
+
+	// The last block is cut short, the replay knows how long it is from numTicks
+	if (s_ticksInBlock)
+		SubmitBlock(BlockBytes(s_header.stateSize, s_ticksInBlock));
+
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		s_quit = true;
+	}
+	s_wake.notify_all();
+	s_writer.join();
+
+	s_header.finalChecksum = StateChecksum();
+	if (s_writeFailed || fseek(s_file, 0, SEEK_SET) != 0 || fwrite(&s_header, sizeof(s_header), 1, s_file) != 1)
+		hr = E_FAIL;
+	if (fclose(s_file) != 0)
+		hr = E_FAIL;
+	s_file = nullptr;
+
+	for (uint i = 0; i < 2; i++)
+	{
+		delete[] s_blocks[i];
+		s_blocks[i] = nullptr;
+	}
+
+	return hr;
+}
+
+/********** Replay ********************************/
+static HRESULT MapFile(const char* path, const unsigned char** data, uint64* size)
+{
+	void* view = nullptr;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return E_FAIL;
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping)
+	{
+		view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping); // The view keeps it alive
+	}
+	CloseHandle(file);
+	*size = view ? fileSize.QuadPart : 0;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+		return E_FAIL;
+
+	struct stat info;
+	if (fstat(file, &info) == 0 && info.st_size > 0)
+	{
+		view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view == MAP_FAILED)
+			view = nullptr;
+	}
+	close(file); // The mapping keeps it alive
+	*size = view ? info.st_size : 0;
+#endif
+
+	*data = (const unsigned char*)view;
+	return view ? S_OK : E_FAIL;
+}
+
+static void UnmapFile(const unsigned char* data, uint64 size)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap((void*)data, size);
+#endif
+}
+
+static const KeyframeHeader* GetKeyframe(const Replay* replay, uint index)
+{
+	return (const KeyframeHeader*)(replay->data + sizeof(RecordingHeader) + uint64(index) * replay->blockSize);
+}
+
+HRESULT OpenReplay(Replay* replay, const char* path)
+{
+	HRESULT hr = S_OK;
+	const RecordingHeader* header;
+	uint64 needed;
+
+	memset(replay, 0, sizeof(*replay));
+	IFC( MapFile(path, &replay->data, &replay->size) );
+
+	hr = E_FAIL;
+	header = (const RecordingHeader*)replay->data;
+	if (replay->size < sizeof(RecordingHeader) || memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != RECORDING_VERSION || header->numNodes != g_numNodes || header->nodeIndexBytes != sizeof(NodeIndex) ||
+		header->stateSize != SimulationStateSize() || header->keyframeInterval == 0 || header->numTicks == 0)
+	{
+		goto Cleanup; // Not a recording, or one from a different build
+	}
+
+	replay->header = header;
+	replay->blockSize = BlockBytes(header->stateSize, header->keyframeInterval);
+	needed = sizeof(RecordingHeader) + uint64(header->numTicks / header->keyframeInterval) * replay->blockSize;
+	if (header->numTicks % header->keyframeInterval)
+		needed += BlockBytes(header->stateSize, header->numTicks % header->keyframeInterval);
+	if (replay->size < needed)
+		goto Cleanup; // Cut off, EndRecording never ran
+
+	IFC( SeekReplay(replay, 0) );
+
+Cleanup:
+	if (FAILED(hr))
+		CloseReplay(replay);
+	return hr;
+}
+
+HRESULT SeekReplay(Replay* replay, uint tick)
+{
+	HRESULT hr = S_OK;
+	const RecordingHeader* header = replay->header;
+	const KeyframeHeader* keyframe;
+	uint index;
+
+	if (header == nullptr || tick > header->numTicks)
+		return E_FAIL;
+
+	// There's no block after the last tick, so the very end is reached from the keyframe before it
+	index = tick / header->keyframeInterval;
+	if (index * header->keyframeInterval == header->numTicks && index > 0)
+		index--;
+
+	keyframe = GetKeyframe(replay, index);
+	LoadSimulationState(keyframe + 1);
+	replay->tick = index * header->keyframeInterval;
+	replay->deltaTime = 0;
+	if (keyframe->tick != replay->tick || StateChecksum() != keyframe->checksum)
+		return E_FAIL; // Corrupt file
+
+	while (replay->tick < tick)
+		IFC( StepReplay(replay) );
+
+Cleanup:
+	return hr;
+}
+
+HRESULT StepReplay(Replay* replay)
+{
+	HRESULT hr = S_OK;
+	const RecordingHeader* header = replay->header;
+	const KeyframeHeader* keyframe;
+	uint offset;
+
+	if (header == nullptr)
+		return E_FAIL;
+	if (replay->tick == header->numTicks)
+		return StateChecksum() == header->finalChecksum ? S_FALSE : E_REPLAY_DIVERGED;
+
+	keyframe = GetKeyframe(replay, replay->tick / header->keyframeInterval);
+	offset = replay->tick % header->keyframeInterval;
+	if (offset == 0)
+	{
+		if (StateChecksum() != keyframe->checksum)
+			return E_REPLAY_DIVERGED;
+
+		// Loading rebuilds the pursuer lists the recording run kept, they end up with the same heads
+		LoadSimulationState(keyframe + 1);
+	}
+
+	memcpy(&replay->deltaTime, (const unsigned char*)keyframe + KeyframeBytes(header->stateSize) + offset * sizeof(double), sizeof(double));
+	IFC( Update(replay->deltaTime) );
+	replay->tick++;
+
+Cleanup:
+	return hr;
+}
+
+void CloseReplay(Replay* replay)
+{
+	if (replay->data)
+		UnmapFile(replay->data, replay->size);
+	memset(replay, 0, sizeof(*replay));
+}
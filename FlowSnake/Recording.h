@@ -0,0 +1,58 @@
+#pragma once
+
+// Recording and replay of simulation runs, so a performance regression can be bisected on the exact same workload.
+// A recording is a header, then one fixed-size block per keyframe interval: the tick and StateChecksum() of the
+// keyframe, the whole simulation state (SaveSimulationState) before that tick's Update(), then the dt of every
+// tick up to the next keyframe. The first keyframe is the initial state. Blocks are handed to a background thread
+// that writes them, so the simulation only pays for the copy.
+// A replay maps the file and feeds the recorded dts to Update(). Since every block is the same size, seeking to
+// any keyframe is one LoadSimulationState, and any other tick is at most a keyframe interval of Update()s away.
+//
+// Replays only match when the run was deterministic, with no g_searchBudgetUs. Without g_doubleBuffer one thread
+// gives different results than several, so replay those with the same kind of thread count as the recording.
+// Options are part of the state, so don't change them between keyframes while recording.
+
+#include "Simulation.h"
+
+#define E_REPLAY_DIVERGED HRESULT(0xA0000003) // The replay got a different checksum than the recording at a keyframe or the end
+
+#define RECORDING_MAGIC "FSNAKREC"
+#define RECORDING_VERSION 5
+#define DEFAULT_KEYFRAME_INTERVAL 600 // Ticks, 10 seconds at 60 Hz
+
+struct RecordingHeader
+{
+	char magic[8];		   // RECORDING_MAGIC
+	uint version;		   // RECORDING_VERSION
+	uint numNodes;		   // g_numNodes and the index size have to match the build that replays it
+	uint nodeIndexBytes;
+	uint stateSize;		   // SimulationStateSize()
+	uint keyframeInterval; // Ticks per block
+	uint numTicks;		   // Filled in by EndRecording
+	uint numThreads;	   // GetWorkerCount() while recording, for reference
+	uint reserved;
+	uint64 finalChecksum;  // StateChecksum() after the last tick
+};
+
+// Only one recording at a time. Call RecordTick(dt) right before every Update(dt).
+HRESULT BeginRecording(const char* path, uint keyframeInterval);
+HRESULT RecordTick(double deltaTime);
+HRESULT EndRecording(); // Waits for the writer and finishes the header
+
+struct Replay
+{
+	const unsigned char* data; // The mapped file
+	uint64 size;
+	const RecordingHeader* header;
+	uint blockSize;
+	uint tick;			// Ticks of the recording the simulation has been through
+	double deltaTime;	// dt of the last StepReplay
+};
+
+// Maps the file and loads the initial state. The options come from the recording too.
+HRESULT OpenReplay(Replay* replay, const char* path);
+// Loads the keyframe at or before tick, then steps up to it. tick can be anything up to header->numTicks.
+HRESULT SeekReplay(Replay* replay, uint tick);
+// Runs Update() for the next recorded tick. S_FALSE once the recording is over.
+HRESULT StepReplay(Replay* replay);
+void CloseReplay(Replay* replay);
@@ -0,0 +1,237 @@
+#include "Replication.h"
+
+// Packet layout, all varints unless noted:
+//   tick, tick - baseline tick (0 for a keyframe), endgame (1 byte), link round,
+//   first link, number of links, then (eater ID, tail ID) for each link in [first, number),
+//   a bitmap of the nodes whose quantized position changed (1 bit per node ID, LSB first),
+//   then zigzag x and y deltas for every changed node, in ID order.
+
+#define POSITION_SHIFT (16 - REPLICATION_POSITION_BITS)
+
+typedef unsigned char byte;
+
+inline byte* WriteVarint(byte* out, uint value)
+{
+	while (value >= 0x80)
+	{
+		*out++ = byte(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = byte(value);
+	return out;
+}
+
+inline uint ZigZag(int value)
+{
+	return (uint(value) << 1) ^ uint(value >> 31);
+}
+
+inline int UnZigZag(uint value)
+{
+	return int(value >> 1) ^ -int(value & 1);
+}
+
+struct PacketReader
+{
+	const byte* next;
+	const byte* end;
+	bool failed; // Ran off the end or hit a varint that's too long, everything read after that is 0
+};
+
+inline uint ReadVarint(PacketReader* reader)
+{
+	uint value = 0;
+	for (uint shift = 0; shift < 35; shift += 7)
+	{
+		if (reader->next == reader->end)
+			break;
+		byte b = *reader->next++;
+		value |= uint(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return value;
+	}
+	reader->failed = true;
+	return 0;
+}
+
+inline byte ReadByte(PacketReader* reader)
+{
+	if (reader->next == reader->end)
+	{
+		reader->failed = true;
+		return 0;
+	}
+	return *reader->next++;
+}
+
+void ClearSnapshots(ReplicationSnapshot* snapshots)
+{
+	for (uint slot = 0; slot < REPLICATION_HISTORY; slot++)
+		snapshots[slot].tick = REPLICATION_NO_TICK;
+}
+
+// The snapshot of tick if it's still around
+ReplicationSnapshot* FindSnapshot(ReplicationSnapshot* snapshots, uint tick)
+{
+	ReplicationSnapshot* snapshot = &snapshots[tick % REPLICATION_HISTORY];
+	return (tick != REPLICATION_NO_TICK && snapshot->tick == tick) ? snapshot : nullptr;
+}
+
+void InitReplicationEncoder(ReplicationEncoder* encoder)
+{
+	ClearSnapshots(encoder->snapshots);
+	encoder->ackedTick = REPLICATION_NO_TICK;
+}
+
+void AckReplication(ReplicationEncoder* encoder, uint tick)
+{
+	if (encoder->ackedTick == REPLICATION_NO_TICK || tick > encoder->ackedTick)
+		encoder->ackedTick = tick; // Acks can arrive out of order, the newest one is the best baseline
+}
+
+HRESULT EncodeReplication(ReplicationEncoder* encoder, uint tick, byte* packet, uint maxSize, uint* size)
+{
+	static const short2 s_origin = {0, 0};
+
+	if (maxSize < MaxReplicationPacketSize() || tick == REPLICATION_NO_TICK)
+		return E_FAIL;
+
+	// A baseline has to be older than this tick and recent enough that its slot wasn't reused
+	ReplicationSnapshot* baseline = FindSnapshot(encoder->snapshots, encoder->ackedTick);
+	if (baseline && (baseline->tick >= tick || tick - baseline->tick >= REPLICATION_HISTORY))
+		baseline = nullptr;
+
+	ReplicationSnapshot* current = &encoder->snapshots[tick % REPLICATION_HISTORY];
+	current->tick = tick;
+	current->linkRound = g_linkRound;
+	current->numLinks = g_numLinks;
+	current->endgame = g_endgame;
+	for (uint id = 0; id < g_numNodes; id++)
+	{
+		NodeIndex i = g_idToIndex[id];
+		current->position[id].x = g_nodes.x[i] >> POSITION_SHIFT;
+		current->position[id].y = g_nodes.y[i] >> POSITION_SHIFT;
+	}
+
+	// Only the links since the baseline, unless there was an explosion in between
+	uint firstLink = (baseline && baseline->linkRound == current->linkRound) ? baseline->numLinks : 0;
+
+	byte* out = packet;
+	out = WriteVarint(out, tick);
+	out = WriteVarint(out, baseline ? tick - baseline->tick : 0);
+	*out++ = byte(current->endgame);
+	out = WriteVarint(out, current->linkRound);
+	out = WriteVarint(out, firstLink);
+	out = WriteVarint(out, current->numLinks);
+	for (uint link = 2 * firstLink; link < 2 * current->numLinks; link++)
+		out = WriteVarint(out, g_links[link]);
+
+	// The bitmap first, then the deltas
+	byte* bitmap = out;
+	out += (g_numNodes + 7) / 8;
+	memset(bitmap, 0, out - bitmap);
+	for (uint id = 0; id < g_numNodes; id++)
+	{
+		short2 from = baseline ? baseline->position[id] : s_origin;
+		short2 to = current->position[id];
+		if (from.x == to.x && from.y == to.y)
+			continue;
+
+		bitmap[id >> 3] |= byte(1 << (id & 7));
+		out = WriteVarint(out, ZigZag(int(to.x) - int(from.x)));
+		out = WriteVarint(out, ZigZag(int(to.y) - int(from.y)));
+	}
+
+	*size = uint(out - packet);
+	return S_OK;
+}
+
+void InitReplicationDecoder(ReplicationDecoder* decoder)
+{
+	ClearSnapshots(decoder->snapshots);
+}
+
+HRESULT DecodeReplication(ReplicationDecoder* decoder, const byte* packet, uint size, const ReplicationSnapshot** snapshot)
+{
+	static const uint maxCoord = (1 << REPLICATION_POSITION_BITS) - 1;
+	PacketReader reader = {packet, packet + size, false};
+	ReplicationSnapshot* baseline = nullptr;
+	ReplicationSnapshot* current;
+
+	uint tick = ReadVarint(&reader);
+	uint age = ReadVarint(&reader);
+	bool endgame = ReadByte(&reader) != 0;
+	uint linkRound = ReadVarint(&reader);
+	uint firstLink = ReadVarint(&reader);
+	uint numLinks = ReadVarint(&reader);
+	if (reader.failed || tick == REPLICATION_NO_TICK || age >= REPLICATION_HISTORY || age > tick || numLinks >= g_numNodes || firstLink > numLinks)
+		return E_FAIL;
+
+	if (age)
+	{
+		baseline = FindSnapshot(decoder->snapshots, tick - age);
+		if (baseline == nullptr)
+			return E_FAIL; // We never got it, or it's been overwritten
+	}
+
+	// The links before firstLink have to be the ones we already have
+	uint haveLinks = (baseline && baseline->linkRound == linkRound) ? baseline->numLinks : 0;
+	if (firstLink != haveLinks)
+		return E_FAIL;
+
+	// Check the whole packet before anything is written, a bad one leaves the links and every snapshot alone
+	const byte* links = reader.next;
+	for (uint link = 2 * firstLink; link < 2 * numLinks; link++)
+	{
+		if (ReadVarint(&reader) >= g_numNodes)
+			return E_FAIL;
+	}
+
+	// Check what's left before stepping over the bitmap, a pointer past the end of the packet is undefined
+	const byte* bitmap = reader.next;
+	if (reader.failed || uint(reader.end - reader.next) < (g_numNodes + 7) / 8)
+		return E_FAIL;
+	reader.next += (g_numNodes + 7) / 8;
+
+	const byte* deltas = reader.next;
+	for (uint id = 0; id < g_numNodes; id++)
+	{
+		if (bitmap[id >> 3] & (1 << (id & 7)))
+		{
+			int x = (baseline ? baseline->position[id].x : 0) + UnZigZag(ReadVarint(&reader));
+			int y = (baseline ? baseline->position[id].y : 0) + UnZigZag(ReadVarint(&reader));
+			if (uint(x) > maxCoord || uint(y) > maxCoord)
+				return E_FAIL;
+		}
+	}
+	if (reader.failed)
+		return E_FAIL;
+
+	// Now read it again for real
+	reader.next = links;
+	for (uint link = 2 * firstLink; link < 2 * numLinks; link++)
+		decoder->links[link] = NodeIndex(ReadVarint(&reader));
+
+	// The baseline's slot can't be the one we write, age is less than REPLICATION_HISTORY
+	current = &decoder->snapshots[tick % REPLICATION_HISTORY];
+	reader.next = deltas;
+	for (uint id = 0; id < g_numNodes; id++)
+	{
+		int x = baseline ? baseline->position[id].x : 0;
+		int y = baseline ? baseline->position[id].y : 0;
+		if (bitmap[id >> 3] & (1 << (id & 7)))
+		{
+			x += UnZigZag(ReadVarint(&reader));
+			y += UnZigZag(ReadVarint(&reader));
+		}
+		current->position[id].x = ushort(x);
+		current->position[id].y = ushort(y);
+	}
+
+	current->tick = tick;
+	current->linkRound = linkRound;
+	current->numLinks = numLinks;
+	current->endgame = endgame;
+	*snapshot = current;
+	return S_OK;
+}
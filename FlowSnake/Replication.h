@@ -0,0 +1,51 @@
+#pragma once
+
+// Snake state replication for remote spectators.
+// EncodeReplication turns the current simulation state into one packet per tick: node positions quantized to
+// REPLICATION_POSITION_BITS and sent as deltas against the last snapshot the client acked, the links Chomp()
+// made since then (g_links), and the round/endgame state, so explosions and resets come across too.
+// Everything is varint coded. Without a usable ack the packet is a keyframe, a delta against all zeros.
+// DecodeReplication rebuilds the same snapshot on the other end. Neither side does any I/O, the transport
+// (and getting the acks back) is up to the caller.
+
+#include "Simulation.h"
+
+#define REPLICATION_HISTORY 16		 // Snapshots kept on each side. Acks older than this get a keyframe.
+#define REPLICATION_POSITION_BITS 12 // Per axis. 4096 steps across the world is finer than any window.
+#define REPLICATION_NO_TICK uint(-1)
+
+struct ReplicationSnapshot
+{
+	uint tick;		// REPLICATION_NO_TICK while the slot is unused
+	uint linkRound; // g_linkRound
+	uint numLinks;	// g_numLinks, the links themselves only ever get appended within a round
+	bool endgame;
+	short2 position[g_numNodes]; // Quantized, by node ID
+};
+
+struct ReplicationEncoder
+{
+	ReplicationSnapshot snapshots[REPLICATION_HISTORY]; // By tick % REPLICATION_HISTORY
+	uint ackedTick;										// Newest tick the client has, REPLICATION_NO_TICK for none
+};
+
+struct ReplicationDecoder
+{
+	ReplicationSnapshot snapshots[REPLICATION_HISTORY];
+	NodeIndex links[2 * g_numNodes]; // The links of the last decoded snapshot's round, like g_links
+};
+
+// Big enough for any packet: header, every link of a round, the changed bitmap and 3 bytes per coordinate
+inline uint MaxReplicationPacketSize()
+{
+	return 64 + 2 * g_numNodes * 5 + g_numNodes / 8 + 1 + 2 * g_numNodes * 3;
+}
+
+void InitReplicationEncoder(ReplicationEncoder* encoder);
+HRESULT EncodeReplication(ReplicationEncoder* encoder, uint tick, unsigned char* packet, uint maxSize, uint* size);
+void AckReplication(ReplicationEncoder* encoder, uint tick); // The client decoded this tick
+
+void InitReplicationDecoder(ReplicationDecoder* decoder);
+// Fails without changing the decoder if the packet is malformed or its baseline is gone.
+// On success *snapshot is the decoded tick.
+HRESULT DecodeReplication(ReplicationDecoder* decoder, const unsigned char* packet, uint size, const ReplicationSnapshot** snapshot);
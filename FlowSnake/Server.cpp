@@ -0,0 +1,270 @@
+// Headless simulation server.
+// Steps Update() at a fixed dt as fast as the machine allows, with no window or GL context,
+// and reports ticks per second so we can size hardware for flOw MMo.
+//
+// Usage: flowsnake_server [-ticks N] [-seconds S] [-dt D] [-report N] [-threads N] [-chainorder 0|1]
+//                         [-engine grid|kdtree] [-grid stride|csr|persistent]
+//                         [-searchfraction F] [-searchbudget US] [-mortonbins 0|1] [-mortonorder 0|1]
+//                         [-doublebuffer 0|1] [-record FILE] [-keyframe N] [-replay FILE] [-seek TICK] [-seed N]
+//
+// Progress lines and the summary print StateChecksum(). With -doublebuffer 1 (and no search budget) a run
+// gives the same checksums for any -threads, so a bug seen on a big machine replays anywhere: rerun with
+// -report 1 to find the first tick where the checksums differ. Without it only -threads 1 differs.
+//
+// -record writes the run to FILE (see Recording.h) with a keyframe every N ticks. -replay runs a recording
+// instead of a fresh world, with the recorded dts and options (-ticks still limits it, -threads is still
+// ours), starting at tick -seek. It fails if the replay stops matching the recording.
+// -seed picks another world (and other explosions), the same seed always gives the same ones.
+
+#include "Simulation.h"
+#include "Profiler.h"
+#include "WorkerPool.h"
+#include "Recording.h"
+#include <stdio.h>
+#include <stdlib.h> // atoi, atof, strtoul
+#include <string.h> // strcmp
+
+struct ServerOptions
+{
+	uint maxTicks;		 // Stop after this many ticks (0 = no limit)
+	double maxSeconds;	 // Stop after this much wall time (0 = no limit)
+	double deltaTime;	 // Fixed simulation step, in seconds
+	uint reportInterval; // Print a progress line every N ticks (0 = only the summary)
+	uint numThreads;	 // Worker threads for Update() (0 = one per hardware thread)
+	bool chainOrder;	 // g_chainOrder
+	TailEngine engine;	 // g_tailEngine
+	GridLayout grid;	 // g_gridLayout
+	float searchFraction; // g_searchFraction
+	uint searchBudgetUs; // g_searchBudgetUs
+	bool mortonBins;	 // g_mortonBins
+	bool mortonOrder;	 // g_mortonOrder
+	bool doubleBuffer;	 // g_doubleBuffer
+	const char* recordPath; // Record to this file
+	uint keyframeInterval;	// Ticks between keyframes in the recording
+	const char* replayPath; // Replay this recording instead of simulating a new world
+	uint seekTick;			// Where to start the replay
+	uint seed;				// g_randomSeed
+};
+
+static const char* s_gridNames[] = { "stride grid", "csr grid", "persistent grid" };
+
+HRESULT ParseOptions(int argc, char* argv[], ServerOptions* options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+		if (value == nullptr)
+		{
+			fprintf(stderr, "Missing value for %s\n", arg);
+			return E_FAIL;
+		}
+
+		if		(strcmp(arg, "-ticks") == 0)   options->maxTicks = atoi(value);
+		else if (strcmp(arg, "-seconds") == 0) options->maxSeconds = atof(value);
+		else if (strcmp(arg, "-dt") == 0)	   options->deltaTime = atof(value);
+		else if (strcmp(arg, "-report") == 0)  options->reportInterval = atoi(value);
+		else if (strcmp(arg, "-threads") == 0) options->numThreads = atoi(value);
+		else if (strcmp(arg, "-chainorder") == 0) options->chainOrder = atoi(value) != 0;
+		else if (strcmp(arg, "-engine") == 0)
+		{
+			if		(strcmp(value, "grid") == 0)   options->engine = ENGINE_GRID;
+			else if (strcmp(value, "kdtree") == 0) options->engine = ENGINE_KDTREE;
+			else
+			{
+				fprintf(stderr, "Unknown engine %s, use grid or kdtree\n", value);
+				return E_FAIL;
+			}
+		}
+		else if (strcmp(arg, "-grid") == 0)
+		{
+			if		(strcmp(value, "stride") == 0)	   options->grid = GRID_STRIDE;
+			else if (strcmp(value, "csr") == 0)		   options->grid = GRID_CSR;
+			else if (strcmp(value, "persistent") == 0) options->grid = GRID_PERSISTENT;
+			else
+			{
+				fprintf(stderr, "Unknown grid %s, use stride, csr or persistent\n", value);
+				return E_FAIL;
+			}
+		}
+		else if (strcmp(arg, "-searchfraction") == 0) options->searchFraction = float(atof(value));
+		else if (strcmp(arg, "-searchbudget") == 0)	  options->searchBudgetUs = atoi(value);
+		else if (strcmp(arg, "-mortonbins") == 0)	  options->mortonBins = atoi(value) != 0;
+		else if (strcmp(arg, "-mortonorder") == 0)	  options->mortonOrder = atoi(value) != 0;
+		else if (strcmp(arg, "-doublebuffer") == 0)	  options->doubleBuffer = atoi(value) != 0;
+		else if (strcmp(arg, "-record") == 0)		  options->recordPath = value;
+		else if (strcmp(arg, "-keyframe") == 0)		  options->keyframeInterval = atoi(value);
+		else if (strcmp(arg, "-replay") == 0)		  options->replayPath = value;
+		else if (strcmp(arg, "-seek") == 0)			  options->seekTick = atoi(value);
+		else if (strcmp(arg, "-seed") == 0)			  options->seed = strtoul(value, nullptr, 0);
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", arg);
+			return E_FAIL;
+		}
+		i++;
+	}
+
+	if (options->deltaTime <= 0)
+	{
+		fprintf(stderr, "-dt must be positive\n");
+		return E_FAIL;
+	}
+
+	if (options->searchFraction <= 0 || options->searchFraction > 1)
+	{
+		fprintf(stderr, "-searchfraction must be in (0, 1]\n");
+		return E_FAIL;
+	}
+
+	if (options->recordPath && options->replayPath)
+	{
+		fprintf(stderr, "-record and -replay can't be used together\n");
+		return E_FAIL;
+	}
+
+	if (options->keyframeInterval == 0)
+	{
+		fprintf(stderr, "-keyframe must be positive\n");
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+int main(int argc, char* argv[])
+{
+	HRESULT hr = S_OK;
+	ServerOptions options = { 10000, 0.0, 1.0 / 60.0, 1000, 0, false, ENGINE_GRID, GRID_STRIDE, 1.0f, 0, false, false, false,
+							  nullptr, DEFAULT_KEYFRAME_INTERVAL, nullptr, 0, g_randomSeed };
+	Replay replay = {};
+	bool recording = false;
+	uint numCores;
+
+	uint64 freq = GetTickFrequency();
+	uint64 startTime;
+	uint64 reportTime;
+	uint tick = 0;
+	uint firstTick = 0;
+	uint rounds = 0;
+	double simulatedTime = 0;
+
+	IFC( ParseOptions(argc, argv, &options) );
+	IFC( InitWorkerPool(options.numThreads) );
+	g_randomSeed = options.seed;
+	IFC( InitSimulation() );
+	numCores = GetWorkerCount();
+	g_chainOrder = options.chainOrder;
+	g_tailEngine = options.engine;
+	g_gridLayout = options.grid;
+	g_searchFraction = options.searchFraction;
+	g_searchBudgetUs = options.searchBudgetUs;
+	g_mortonBins = options.mortonBins;
+	g_mortonOrder = options.mortonOrder;
+	g_doubleBuffer = options.doubleBuffer;
+
+	if (options.replayPath)
+	{
+		hr = OpenReplay(&replay, options.replayPath);
+		if (SUCCEEDED(hr))
+			hr = SeekReplay(&replay, options.seekTick);
+		if (FAILED(hr))
+		{
+			fprintf(stderr, "Can't replay %s from tick %u\n", options.replayPath, options.seekTick);
+			goto Cleanup;
+		}
+		firstTick = options.seekTick;
+		printf("Replaying %s: %u ticks, keyframe every %u, recorded with %u threads\n", options.replayPath,
+			   replay.header->numTicks, replay.header->keyframeInterval, replay.header->numThreads);
+	}
+	else if (options.recordPath)
+	{
+		if (FAILED(hr = BeginRecording(options.recordPath, options.keyframeInterval)))
+		{
+			fprintf(stderr, "Can't record to %s\n", options.recordPath);
+			goto Cleanup;
+		}
+		recording = true;
+	}
+
+	printf("flowsnake_server: %u nodes, dt = %.4f s, %u threads, %s%s%s%s\n", g_numNodes, options.deltaTime, numCores,
+		   g_tailEngine == ENGINE_KDTREE ? "k-d tree" : s_gridNames[g_gridLayout], g_mortonBins ? " (morton bins)" : "",
+		   g_chainOrder ? ", chain ordered" : "", g_chainOrder && g_mortonOrder ? " in morton order" : "");
+	if (g_doubleBuffer)
+		printf("Double buffered positions\n");
+	if (g_searchFraction < 1.0f || g_searchBudgetUs)
+		printf("Re-searching %.0f%% of heads per frame, %u us search budget\n", g_searchFraction * 100.0f, g_searchBudgetUs);
+
+	startTime = reportTime = GetTicks();
+	for (tick = 0; options.maxTicks == 0 || tick < options.maxTicks; tick++)
+	{
+		bool wasEndgame = g_endgame;
+
+		if (options.replayPath)
+		{
+			hr = StepReplay(&replay);
+			if (hr == E_REPLAY_DIVERGED)
+				fprintf(stderr, "Replay diverged from the recording at tick %u\n", replay.tick);
+			IFC( hr );
+			if (hr == S_FALSE)
+				break; // End of the recording
+			simulatedTime += replay.deltaTime;
+		}
+		else
+		{
+			if (recording)
+				IFC( RecordTick(options.deltaTime) );
+			IFC( Update(options.deltaTime) );
+			simulatedTime += options.deltaTime;
+		}
+
+		if (wasEndgame && !g_endgame)
+			rounds++; // The giant snake exploded and the world has been reset
+
+		uint64 now = GetTicks();
+		if (options.reportInterval && (tick + 1) % options.reportInterval == 0)
+		{
+			double elapsed = double(now - reportTime) / freq;
+			printf("tick %8u  active %5d  %s  %10.1f ticks/s  checksum %016llx\n", firstTick + tick + 1, g_numActiveNodes,
+				   g_endgame ? "endgame" : "chasing", options.reportInterval / elapsed, StateChecksum());
+			reportTime = GetTicks(); // Don't count the checksum
+		}
+
+		if (options.maxSeconds > 0 && double(now - startTime) / freq >= options.maxSeconds)
+		{
+			tick++;
+			break;
+		}
+	}
+
+	if (recording)
+	{
+		recording = false;
+		if (FAILED(hr = EndRecording()))
+		{
+			fprintf(stderr, "Writing %s failed\n", options.recordPath);
+			goto Cleanup;
+		}
+	}
+
+	{
+		double elapsed = double(GetTicks() - startTime) / freq;
+		double ticksPerSecond = tick / elapsed;
+		printf("------------- Server Summary ---------------------\n");
+		printf("Ticks simulated = %u (%u completed rounds)\n", tick, rounds);
+		printf("Wall time = %.3f s\n", elapsed);
+		printf("Average tick duration = %.3f ms\n", elapsed / tick * 1000.0);
+		printf("Ticks per second = %.1f (%.1f per core, %u cores)\n", ticksPerSecond, ticksPerSecond / numCores, numCores);
+		printf("Realtime factor = %.1fx\n", simulatedTime / elapsed);
+		printf("State checksum = %016llx\n", StateChecksum());
+	}
+	PrintProfile(stdout, "Phase Profile");
+
+Cleanup:
+	if (recording)
+		EndRecording();
+	CloseReplay(&replay);
+	ShutdownWorkerPool();
+	return FAILED(hr);
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+// Thin wrappers over the float SIMD instructions we use, so kernels are written once.
+// floatv holds SIMD_WIDTH lanes: 8 with AVX, 4 with SSE2, and 1 (plain float) everywhere else.
+// Only IEEE exact operations are wrapped (no rsqrt/rcp approximations), so a kernel gives
+// bit-identical results to the scalar code it replaces no matter which width it was built for.
+
+#if defined(__AVX__)
+#	include <immintrin.h>
+#	define SIMD_WIDTH 8
+
+typedef __m256 floatv;
+typedef __m256i intv;
+
+inline floatv LoadV(const float* p)			{ return _mm256_loadu_ps(p); }
+inline void StoreV(float* p, floatv a)		{ _mm256_storeu_ps(p, a); }
+inline void StoreV(int* p, intv a)			{ _mm256_storeu_si256((__m256i*)p, a); }
+inline floatv SetV(float a)					{ return _mm256_set1_ps(a); }
+inline floatv Add(floatv a, floatv b)		{ return _mm256_add_ps(a, b); }
+inline floatv Sub(floatv a, floatv b)		{ return _mm256_sub_ps(a, b); }
+inline floatv Mul(floatv a, floatv b)		{ return _mm256_mul_ps(a, b); }
+inline floatv Div(floatv a, floatv b)		{ return _mm256_div_ps(a, b); }
+inline floatv Sqrt(floatv a)				{ return _mm256_sqrt_ps(a); }
+inline floatv CmpLT(floatv a, floatv b)		{ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline floatv CmpNEQ(floatv a, floatv b)	{ return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+inline floatv Select(floatv mask, floatv a, floatv b) { return _mm256_blendv_ps(b, a, mask); } // mask ? a : b
+inline intv TruncateToInt(floatv a)			{ return _mm256_cvttps_epi32(a); }
+
+inline floatv LoadUshortV(const ushort* p)
+{
+	__m128i a = _mm_loadu_si128((const __m128i*)p);
+	__m128i zero = _mm_setzero_si128();
+	return _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(a, zero)), _mm_unpackhi_epi16(a, zero), 1));
+}
+
+// ushort(int(a)) in every lane: truncated, and wrapped rather than clamped
+inline void StoreUshortV(ushort* p, floatv a)
+{
+	__m256i ints = _mm256_cvttps_epi32(a);
+	__m128i lo = _mm256_castsi256_si128(ints);
+	__m128i hi = _mm256_extractf128_si256(ints, 1);
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16); // Sign extend the low 16 bits, so the saturating pack keeps them
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+	_mm_storeu_si128((__m128i*)p, _mm_packs_epi32(lo, hi));
+}
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define SIMD_WIDTH 4
+
+typedef __m128 floatv;
+typedef __m128i intv;
+
+inline floatv LoadV(const float* p)			{ return _mm_loadu_ps(p); }
+inline void StoreV(float* p, floatv a)		{ _mm_storeu_ps(p, a); }
+inline void StoreV(int* p, intv a)			{ _mm_storeu_si128((__m128i*)p, a); }
+inline floatv SetV(float a)					{ return _mm_set1_ps(a); }
+inline floatv Add(floatv a, floatv b)		{ return _mm_add_ps(a, b); }
+inline floatv Sub(floatv a, floatv b)		{ return _mm_sub_ps(a, b); }
+inline floatv Mul(floatv a, floatv b)		{ return _mm_mul_ps(a, b); }
+inline floatv Div(floatv a, floatv b)		{ return _mm_div_ps(a, b); }
+inline floatv Sqrt(floatv a)				{ return _mm_sqrt_ps(a); }
+inline floatv CmpLT(floatv a, floatv b)		{ return _mm_cmplt_ps(a, b); }
+inline floatv CmpNEQ(floatv a, floatv b)	{ return _mm_cmpneq_ps(a, b); }
+inline floatv Select(floatv mask, floatv a, floatv b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline intv TruncateToInt(floatv a)			{ return _mm_cvttps_epi32(a); }
+
+inline floatv LoadUshortV(const ushort* p)
+{
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()));
+}
+
+// ushort(int(a)) in every lane: truncated, and wrapped rather than clamped
+inline void StoreUshortV(ushort* p, floatv a)
+{
+	__m128i ints = _mm_cvttps_epi32(a);
+	ints = _mm_srai_epi32(_mm_slli_epi32(ints, 16), 16); // Sign extend the low 16 bits, so the saturating pack keeps them
+	_mm_storel_epi64((__m128i*)p, _mm_packs_epi32(ints, ints));
+}
+
+#else
+#	include <math.h>
+#	define SIMD_WIDTH 1
+
+typedef float floatv;
+typedef int intv;
+
+inline floatv LoadV(const float* p)			{ return *p; }
+inline void StoreV(float* p, floatv a)		{ *p = a; }
+inline void StoreV(int* p, intv a)			{ *p = a; }
+inline floatv SetV(float a)					{ return a; }
+inline floatv Add(floatv a, floatv b)		{ return a + b; }
+inline floatv Sub(floatv a, floatv b)		{ return a - b; }
+inline floatv Mul(floatv a, floatv b)		{ return a * b; }
+inline floatv Div(floatv a, floatv b)		{ return a / b; }
+inline floatv Sqrt(floatv a)				{ return sqrtf(a); }
+inline floatv CmpLT(floatv a, floatv b)		{ return a < b ? 1.0f : 0.0f; }
+inline floatv CmpNEQ(floatv a, floatv b)	{ return a != b ? 1.0f : 0.0f; }
+inline floatv Select(floatv mask, floatv a, floatv b) { return mask != 0.0f ? a : b; }
+inline intv TruncateToInt(floatv a)			{ return int(a); }
+inline floatv LoadUshortV(const ushort* p)	{ return *p; }
+inline void StoreUshortV(ushort* p, floatv a) { *p = ushort(int(a)); }
+#endif
+
+// 32-bit unsigned integer lanes, for the counter based RNG (Random.h). AVX has no 256-bit integer ops
+// (that's AVX2), so these are 4 wide whenever SSE2 is there, AVX builds included.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define UINTV_WIDTH 4
+
+typedef __m128i uintv;
+
+inline uintv SetU(uint a)					{ return _mm_set1_epi32(int(a)); }
+inline uintv LaneIndexes()					{ return _mm_setr_epi32(0, 1, 2, 3); }
+inline uintv AddU(uintv a, uintv b)			{ return _mm_add_epi32(a, b); }
+inline uintv XorU(uintv a, uintv b)			{ return _mm_xor_si128(a, b); }
+inline uintv AndU(uintv a, uintv b)			{ return _mm_and_si128(a, b); }
+inline uintv ShiftLeftU(uintv a, int n)		{ return _mm_slli_epi32(a, n); }
+inline uintv ShiftRightU(uintv a, int n)	{ return _mm_srli_epi32(a, n); }
+
+// Full 32x32 -> 64-bit products of every lane with m. Returns the low halves, *hi gets the high ones.
+inline uintv MulHiLo(uintv a, uint m, uintv* hi)
+{
+	uintv mv = SetU(m);
+	uintv even = _mm_shuffle_epi32(_mm_mul_epu32(a, mv), _MM_SHUFFLE(3, 1, 2, 0));					   // lo0 lo2 hi0 hi2
+	uintv odd = _mm_shuffle_epi32(_mm_mul_epu32(_mm_srli_epi64(a, 32), mv), _MM_SHUFFLE(3, 1, 2, 0)); // lo1 lo3 hi1 hi3
+	*hi = _mm_unpackhi_epi32(even, odd);
+	return _mm_unpacklo_epi32(even, odd);
+}
+
+// Low 32 bits of every lane times m, SSE2 has no 32-bit multiply (pmulld is SSE4.1)
+inline uintv MulLo(uintv a, uint m)
+{
+	uintv mv = SetU(m);
+	uintv even = _mm_shuffle_epi32(_mm_mul_epu32(a, mv), _MM_SHUFFLE(0, 0, 2, 0));
+	uintv odd = _mm_shuffle_epi32(_mm_mul_epu32(_mm_srli_epi64(a, 32), mv), _MM_SHUFFLE(0, 0, 2, 0));
+	return _mm_unpacklo_epi32(even, odd);
+}
+
+// The top 24 bits of every lane as floats in [0, 1), exactly like UnitFloat
+inline void StoreUnitFloats(float* p, uintv a)
+{
+	_mm_storeu_ps(p, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(a, 8)), _mm_set1_ps(1.0f / 16777216.0f)));
+}
+
+#else
+#	define UINTV_WIDTH 1
+
+typedef uint uintv;
+
+inline uintv SetU(uint a)					{ return a; }
+inline uintv LaneIndexes()					{ return 0; }
+inline uintv AddU(uintv a, uintv b)			{ return a + b; }
+inline uintv XorU(uintv a, uintv b)			{ return a ^ b; }
+inline uintv AndU(uintv a, uintv b)			{ return a & b; }
+inline uintv ShiftLeftU(uintv a, int n)		{ return a << n; }
+inline uintv ShiftRightU(uintv a, int n)	{ return a >> n; }
+
+inline uintv MulHiLo(uintv a, uint m, uintv* hi)
+{
+	uint64 product = uint64(a) * m;
+	*hi = uint(product >> 32);
+	return uint(product);
+}
+
+inline uintv MulLo(uintv a, uint m)			{ return a * m; }
+
+inline void StoreUnitFloats(float* p, uintv a)
+{
+	*p = float(a >> 8) * (1.0f / 16777216.0f);
+}
+#endif
@@ -0,0 +1,1951 @@
+#include "Simulation.h"
+#include "Profiler.h" // BeginPhase, EndPhase
+#include "WorkerPool.h" // ParallelFor
+#include "Simd.h"		// floatv, SIMD_WIDTH
+#include "Random.h"
+#include <atomic>
+
+// Bin groups are binned and searched in parallel, each one needs its own slot storage. The split is fixed
+// per build rather than following the thread count, since the groups decide which tails a head can find.
+#ifndef FLOWSNAKE_BIN_SPLITS
+#	ifdef FLOWSNAKE_WIDE_INDEX
+#		define FLOWSNAKE_BIN_SPLITS 4
+#	else
+#		define FLOWSNAKE_BIN_SPLITS 2
+#	endif
+#endif
+#define MAX_BIN_GROUPS (FLOWSNAKE_BIN_SPLITS * FLOWSNAKE_BIN_SPLITS)
+
+#define NODES_PER_SEARCH_TASK 1024
+#define SEARCHES_PER_BUDGETED_TASK 64 // Small, the budget is only checked between tasks
+#define SCREEN_TAILS_PER_BIN 2 // Average number of tails in a bin of the CSR and persistent grids
+#define POSITION_BATCH 16 // Nodes per pass of the SIMD position kernel. Multiple of SIMD_WIDTH.
+#define POSITION_TASK_NODES 4096 // Nodes per position update task. Multiple of POSITION_BATCH.
+#define MAX_POSITION_TASKS (g_numNodes / POSITION_TASK_NODES + 1)
+#define MORTON_ORDER_BITS 6 // Cells per side of the grid g_mortonOrder sorts the heads into, as a power of two
+#define MORTON_REORDER_FRAMES 64 // Snakes drift, so g_mortonOrder re-sorts them this often
+#define FALLBACKS_PER_TASK 64
+#define MAX_SEARCH_RINGS 8 // A head that lost its target and has no valid tail this many bins out is isolated, the fallback search is cheaper
+
+// A rectangle of bins plus a one bin halo, backed by its own slots
+struct BinGroup
+{
+	int rangeX[2];	 // The inclusive range of bins (X dimension) that are backed by memory
+	int rangeY[2];	 // The inclusive range of bins (Y dimension) that are backed by memory
+	uint stride;	 // Number of slots per bin. Each slot holds an index to a node
+	NodeIndex* slots;
+	bool morton;	 // Bins in BinIndex Z-order rather than row-major
+	uint dropped;	 // Tails that found their bin full in the last binning pass
+};
+
+// A grid covering the whole screen with no halo (GRID_CSR and GRID_PERSISTENT)
+struct ScreenGrid
+{
+	uint countX;
+	uint countY;
+	float nWidth;  // Bin size in normalized (0..1) space
+	float nHeight;
+	bool morton;   // Bins in BinIndex Z-order rather than row-major
+};
+
+float g_speed = 0.2f;			  // in Screens per second
+
+/********** Globals Variables *********************/
+uint g_width = 1024;
+uint g_height = 768;
+
+int g_numActiveNodes = g_numNodes;   // Number of head nodes that are actively seeking tails to chomp
+
+const uint g_numBinSplits = FLOWSNAKE_BIN_SPLITS; // Divide the bins g_numBinSplits times in each dimension. Each bin group is one worker pool task.
+BinGroup g_binGroups[MAX_BIN_GROUPS];
+
+uint g_binCountX;	// Number of bins in the X dimension needed to fill the screen
+uint g_binCountY;	// Number of bins in the X dimension needed to fill the screen
+float g_binNWidth;  // Bin width in normalized (0..1) space
+float g_binNHeight; // Bin height in normalized (0..1) space
+
+bool g_endgame = false;
+bool g_chainOrder = false;
+GridLayout g_gridLayout = GRID_STRIDE;
+TailEngine g_tailEngine = ENGINE_GRID;
+bool g_mortonBins = false;
+bool g_mortonOrder = false;
+bool g_doubleBuffer = false;
+uint g_framesSinceReorder = 0; // Frames since ReorderChains last ran, for g_mortonOrder
+double g_endgameTime = 0;	   // Seconds since the explosion
+float g_explosionStep = 0.0f;  // Distance a node at top speed moves this frame, for ExplosionTask
+uint g_explosionKey = 0;	   // Hash key of this explosion's velocities
+uint g_randomSeed = 123456789;
+uint g_worldRound = 0;		   // g_linkRound when InitSimulation made this world, explosions are counted from it
+
+// The counting sort grid is rebuilt every frame. Bin b holds the tails in g_csrSlots[g_csrStart[b], g_csrStart[b+1]).
+// Both arrays live in g_slots, like the stride layout.
+ScreenGrid g_csrGrid;
+NodeIndex* g_csrStart; // One entry per bin, plus the end of the last one
+NodeIndex* g_csrSlots; // Every tail, sorted by bin
+
+// The persistent grid keeps every tail in a singly linked list for its bin, by node ID so chain ordering
+// doesn't disturb it. The position update queues the tails that crossed into another bin, Chomp() removes
+// the tails that get eaten, and it is only rebuilt when the number of snakes halves (to keep the bins about
+// SCREEN_TAILS_PER_BIN full) and when the explosion is over.
+ScreenGrid g_persistentGrid;
+NodeIndex g_gridHeads[g_numNodes]; // First tail ID in each bin
+NodeIndex g_gridNext[g_numNodes];  // Next tail ID in the same bin
+NodeIndex g_gridBin[g_numNodes];   // Bin of each tail ID, EMPTY_SLOT when it isn't in the grid
+NodeIndex g_gridMoves[g_numNodes]; // Tail IDs that crossed into another bin this frame
+uint g_numGridMoves = 0;
+int g_gridBuiltFor = 0;			   // g_numActiveNodes when the grid was built, 0 while it isn't maintained
+
+// Heads whose search came up empty while their old target was taken (the stride layout only searches
+// their bin group). They are queued by storage index and resolved after the searches, with the k-d tree
+// over every tail. The tree is only built in frames that need it, unless it's the engine anyway.
+NodeIndex g_fallbackSearches[g_numNodes];
+std::atomic<uint> g_numFallbackSearches(0);
+
+// The tail each head's search found, by storage index, EMPTY_SLOT if it found nothing. targetID shares its
+// word with the hasChild/hasParent bits the other searches read, so the searches leave it alone and
+// ApplySearchResults copies these over once they're all done.
+NodeIndex g_foundTargets[g_numNodes];
+
+float g_searchFraction = 1.0f;
+uint g_searchBudgetUs = 0;
+
+// With a search fraction or budget, a frame first searches the heads whose target was taken (urgent),
+// then the next g_searchFraction of g_heads after g_searchCursor, so the cost follows the heads left, not
+// g_numNodes. Chomp() swaps the last head into a removed one's slot, which can put it behind the cursor,
+// it just waits one more lap.
+// Both parts are cut into tasks of SEARCHES_PER_BUDGETED_TASK, and no task starts after the deadline.
+NodeIndex g_urgentSearches[g_numNodes]; // Node IDs, each one at most once
+uint g_numUrgentSearches = 0;
+bool g_urgentQueued[g_numNodes];		// By ID, in g_urgentSearches
+uint g_numUrgentTasks = 0;
+uint g_numScheduledTasks = 0; // Urgent tasks, then round robin ones
+uint g_searchQuota = 0;		 // Heads the round robin part covers this frame
+uint g_searchCursor = 0;	 // Slot in g_heads the round robin part starts at, taken mod g_numHeads
+uint64 g_searchDeadline = 0; // GetTicks() value to stop at, 0 for no limit
+bool g_searchTaskDone[2 * (g_numNodes / SEARCHES_PER_BUDGETED_TASK + 1)];
+
+// While searches are scheduled, every head is linked into a list of the pursuers of the tail it targets,
+// unless it's waiting in g_urgentSearches. Chomp() queues exactly the heads its chomp leaves with a dead
+// target, so nothing has to check every head every frame. Heads are relinked after they're searched.
+// All by node ID. Rebuilt from scratch when scheduling starts, it isn't maintained otherwise.
+NodeIndex g_firstPursuer[g_numNodes]; // By tail ID
+NodeIndex g_nextPursuer[g_numNodes];  // By head ID, doubly linked
+NodeIndex g_prevPursuer[g_numNodes];
+NodeIndex g_pursuedTail[g_numNodes];  // By head ID, the list it's in, EMPTY_SLOT when it isn't
+bool g_pursuersValid = false;
+
+NodeIndex g_idToIndex[g_numNodes];
+NodeIndex g_indexToId[g_numNodes];
+
+// For the head and tail of every snake (by ID), the ID of the snake's other end. Single segments point at
+// themselves. Values in the middle of a snake are stale, nothing reads them.
+NodeIndex g_snakeEnd[g_numNodes];
+
+// Dense lists of the current heads and tails (by ID), in no particular order, so the binning and search
+// loops don't have to skip over the nodes in the middle of snakes. Chomp() takes one of each out, and a
+// single segment snake is on both. g_headSlot/g_tailSlot are where each ID sits, EMPTY_SLOT if it doesn't.
+NodeIndex g_heads[g_numNodes];
+NodeIndex g_tails[g_numNodes];
+NodeIndex g_headSlot[g_numNodes];
+NodeIndex g_tailSlot[g_numNodes];
+uint g_numHeads = 0;
+uint g_numTails = 0;
+
+// The position update runs in tasks of POSITION_TASK_NODES. A head that reaches a valid target claims it by
+// lowering g_tailClaims[tail ID] to its own storage index with a compare and swap, so the winner is the head a
+// serial loop would have got to first, whatever order the tasks ran in. Each task writes its claimants and
+// tail moves into its own range of g_chompClaims and g_gridMoves. ResolveChomps() chomps for the winners
+// in storage order afterwards, and the losers get searched again like anyone else whose target was eaten.
+std::atomic<NodeIndex> g_tailClaims[g_numNodes]; // EMPTY_SLOT when unclaimed
+NodeIndex g_chompClaims[g_numNodes];			 // Storage indexes
+uint g_numTaskClaims[MAX_POSITION_TASKS];
+uint g_numTaskMoves[MAX_POSITION_TASKS];
+float g_positionStep = 0.0f;
+
+// With g_doubleBuffer or more than one worker the position update reads every target from these, a copy
+// of the positions from before it started, instead of from g_nodes while other tasks write it
+ushort g_prevX[g_numNodes];
+ushort g_prevY[g_numNodes];
+bool g_readPrevPositions = false;
+
+NodeIndex g_links[2 * g_numNodes];
+uint g_numLinks = 0;
+uint g_linkRound = 0;
+
+// Heads that chomped this frame (by ID), their snakes get joined in storage after the position update
+NodeIndex g_pendingJoins[g_numNodes];
+uint g_numPendingJoins = 0;
+bool g_chainsContiguous = true; // False once a chomp happened with g_chainOrder off
+
+static_assert(g_numNodes < MAX_NODE_COUNT, "Too many nodes for the node index width, build with FLOWSNAKE_WIDE_INDEX");
+
+#ifdef FLOWSNAKE_WIDE_INDEX
+NodeArrays g_nodes;
+#else
+// Initialize these to nonzero so they go into .DATA and not .BSS (and show in the executable size)
+NodeArrays g_nodes = {{1}, {1}, {{0,0,1}}};
+#endif
+
+// 128k total memory. 
+// I think I can pack particle attributes into 6 bytes. (2 shorts for pos, 1 short for target and state)
+// Targeting 16000 particles, that leaves 35072 bytes (34.25k)
+// Leave 4.25k for the .exe and extra .data
+// That's 30k for the spatial partioning scheme
+// With run-time variable resolution we'll have to do some math to calculate bin size
+// What's fixed: the number of bins, or their size? ... the number of bins (should make the math easier)
+// TotalBinCost = 2 * SlotsPerBin * NumBins ....
+// No, no. How about a dynamic number of bins, based on the number of active particles. 
+// Start with 16k particles, 1 bin for every 4 particles. 4000 bins, 4 slots each, 2 bytes per slot. 
+// Then reduce the number of active bins every time we halve the number of active particles.
+// Well it's a start. That's 32000 bytes for spatial partitioning, plus 96000 for the particles = 128000. 
+// That leaves 3072 bytes for the .exe and extra .data. Close to doable!
+// But wait! We don't need to calculate everybody's nearest neighbor every frame,
+// If we save the targets, we can re-search every 4th or so frame (that's 64ms max, shouldn't be noticeable)
+// Then we only need a quarter of the binning space! Woo! 
+// So thats 4000 slots (1 short each) for 16000 particles. Which leaves 27072 bytes left over. Nice.
+// Each bin group gets a full set of slots so the groups can be binned in parallel.
+//
+// That was the single threaded stride grid. Everything since is static too, and at 16000 nodes the
+// simulation's data is 1088000 bytes now (32000 for each array with an index per node):
+//	 nodes 96000, stride grid slots 64000 (4 bin groups)
+//	 node IDs, snake ends and pending joins 128000, head and tail lists 128000
+//	 persistent grid 128000, k-d tree 96000, fallback queue and search results 64000
+//	 pursuers and search scheduling 176000 + Morton head sort 16000
+//	 position update claims 64000, double buffer 64000, links 64000
+// The options can all be switched at run time, so none of it is compiled out. The 128k only holds for
+// the nodes and one set of slots.
+#ifdef FLOWSNAKE_WIDE_INDEX
+NodeIndex g_slots[MAX_BIN_GROUPS][g_numSlots];
+#else
+NodeIndex g_slots[MAX_BIN_GROUPS][g_numSlots] = {{0xFFFF}}; 
+#endif
+
+/**************************************************/
+
+// Storage index of the node's target
+inline NodeIndex TargetIndex(NodeIndex index)
+{
+	return g_idToIndex[g_nodes.attribs[index].targetID];
+}
+
+// current is always a head, so the only tail it can't chase is the one at the other end of its snake
+inline bool IsValidTarget(NodeIndex target, NodeIndex current)
+{
+	if (target == current) return false;						// Can't chase ourselves
+	if (g_nodes.attribs[target].hasChild == true) return false;	// It can't already have a child
+
+	return g_snakeEnd[g_indexToId[current]] != g_indexToId[target]; // Can't chase our own tail
+}
+
+void GridInsert(NodeIndex id, uint bin)
+{
+	g_gridBin[id] = bin;
+	g_gridNext[id] = g_gridHeads[bin];
+	g_gridHeads[bin] = id;
+}
+
+// Bins hold about SCREEN_TAILS_PER_BIN tails, so finding the link to unhook is cheap
+void GridRemove(NodeIndex id)
+{
+	NodeIndex* link = &g_gridHeads[g_gridBin[id]];
+	while (*link != id)
+		link = &g_gridNext[*link];
+	*link = g_gridNext[id];
+	g_gridBin[id] = EMPTY_SLOT;
+}
+
+// Add the head to the front of the tail's pursuer list
+inline void LinkPursuer(NodeIndex head, NodeIndex tail)
+{
+	NodeIndex next = g_firstPursuer[tail];
+	g_pursuedTail[head] = tail;
+	g_prevPursuer[head] = EMPTY_SLOT;
+	g_nextPursuer[head] = next;
+	if (next != EMPTY_SLOT) g_prevPursuer[next] = head;
+	g_firstPursuer[tail] = head;
+}
+
+inline void UnlinkPursuer(NodeIndex head)
+{
+	NodeIndex tail = g_pursuedTail[head];
+	if (tail == EMPTY_SLOT)
+		return;
+
+	NodeIndex prev = g_prevPursuer[head];
+	NodeIndex next = g_nextPursuer[head];
+	if (prev != EMPTY_SLOT) g_nextPursuer[prev] = next;
+	else					g_firstPursuer[tail] = next;
+	if (next != EMPTY_SLOT) g_prevPursuer[next] = prev;
+	g_pursuedTail[head] = EMPTY_SLOT;
+}
+
+// Take the head out of its pursuer list and have it searched first next frame
+inline void QueueUrgentSearch(NodeIndex head)
+{
+	UnlinkPursuer(head);
+	if (!g_urgentQueued[head])
+	{
+		g_urgentQueued[head] = true;
+		g_urgentSearches[g_numUrgentSearches++] = head;
+	}
+}
+
+// Swap the last entry into the removed one's place
+inline void RemoveFromList(NodeIndex* list, NodeIndex* slots, uint* count, NodeIndex id)
+{
+	NodeIndex slot = slots[id];
+	ASSERT(slot != EMPTY_SLOT);
+	NodeIndex last = list[--*count];
+	list[slot] = last;
+	slots[last] = slot;
+	slots[id] = EMPTY_SLOT;
+}
+
+void RebuildNodeLists()
+{
+	g_numHeads = g_numTails = 0;
+	for (uint i = 0; i < g_numNodes; i++)
+	{
+		NodeIndex id = g_indexToId[i];
+		g_headSlot[id] = g_tailSlot[id] = EMPTY_SLOT;
+		if (!g_nodes.attribs[i].hasParent)
+		{
+			g_headSlot[id] = g_numHeads;
+			g_heads[g_numHeads++] = id;
+		}
+		if (!g_nodes.attribs[i].hasChild)
+		{
+			g_tailSlot[id] = g_numTails;
+			g_tails[g_numTails++] = id;
+		}
+	}
+}
+
+// The Node pointed to by node index is in range of it's target
+// If it's still a valid target (no one chomped it this frame) 
+// then join these two segments
+HRESULT Chomp(NodeIndex nodeIndex)
+{
+	NodeIndex target = TargetIndex(nodeIndex);
+	
+	if (IsValidTarget(target, nodeIndex))
+	{
+		g_nodes.attribs[nodeIndex].hasParent = true;
+		g_nodes.attribs[target].hasChild = true;
+		--g_numActiveNodes;
+		RemoveFromList(g_heads, g_headSlot, &g_numHeads, g_indexToId[nodeIndex]);
+		RemoveFromList(g_tails, g_tailSlot, &g_numTails, g_indexToId[target]);
+
+		if (g_gridBuiltFor)
+			GridRemove(g_indexToId[target]); // Not a tail anymore
+
+		ASSERT(g_numLinks + 1 < g_numNodes);
+		g_links[2 * g_numLinks] = g_indexToId[nodeIndex];
+		g_links[2 * g_numLinks + 1] = g_indexToId[target];
+		g_numLinks++;
+
+		// The target's head now leads all the way to our tail
+		NodeIndex ourTail = g_snakeEnd[g_indexToId[nodeIndex]];
+		NodeIndex theirHead = g_snakeEnd[g_indexToId[target]];
+		g_snakeEnd[theirHead] = ourTail;
+		g_snakeEnd[ourTail] = theirHead;
+
+		if (g_pursuersValid)
+		{
+			// Everyone chasing the tail we ate, us included (we're not a head anymore, so we don't get queued).
+			// Their head may have been chasing our tail, which is now its own.
+			NodeIndex eater = g_indexToId[nodeIndex];
+			NodeIndex victim = g_indexToId[target];
+			while (g_firstPursuer[victim] != EMPTY_SLOT)
+			{
+				NodeIndex pursuer = g_firstPursuer[victim];
+				if (pursuer == eater) UnlinkPursuer(pursuer);
+				else				  QueueUrgentSearch(pursuer);
+			}
+			if (g_pursuedTail[theirHead] == ourTail)
+				QueueUrgentSearch(theirHead);
+		}
+
+		// Storage can't move under the position update, so the snakes are joined after it
+		if (g_chainOrder)
+			g_pendingJoins[g_numPendingJoins++] = g_indexToId[nodeIndex];
+		else
+			g_chainsContiguous = false;
+	}
+
+	return S_OK;
+}
+
+// Given xy bin coordinates return the bin's index into the group's slot buffer
+HRESULT Bin(const BinGroup& group, int binX, int binY, int* bin)
+{
+	if (bin) *bin = BinIndex(binX - group.rangeX[0], binY - group.rangeY[0], group.rangeX[1] - group.rangeX[0] + 1, group.morton);
+
+	// Return E_FAIL if the bin is outside the mem mapped zone
+	if (binX < group.rangeX[0] || binX > group.rangeX[1] ||
+		binY < group.rangeY[0] || binY > group.rangeY[1] ) 
+		return E_FAIL;
+
+	// Return S_BOUNDARY if this bin is on the outside edge (the buffer zone)
+	if (binX == group.rangeX[0] || binX == group.rangeX[1] ||
+		binY == group.rangeY[0] || binY == group.rangeY[1])
+		return S_BOUNDARY;
+	
+	// Return S_OK if it is inside
+	else
+		return S_OK;
+}
+
+// Given a position in normalized 0..1 space, find the position's bin and 
+// return its index into the group's slot buffer
+HRESULT Bin(const BinGroup& group, float posx, float posy, int* bin)
+{
+	int bucketX = uint(posx / g_binNWidth);
+	int bucketY = uint(posy / g_binNHeight);
+	return Bin(group, bucketX, bucketY, bin);
+}
+
+// The bin group whose interior (halo excluded) holds the position
+const BinGroup& GetBinGroup(float posx, float posy)
+{
+	uint bucketX = uint(posx / g_binNWidth);
+	uint bucketY = uint(posy / g_binNHeight);
+
+	uint xiter = 0;
+	uint yiter = 0;
+	while (xiter + 1 < g_numBinSplits && bucketX >= g_binCountX * (xiter+1)/g_numBinSplits) xiter++;
+	while (yiter + 1 < g_numBinSplits && bucketY >= g_binCountY * (yiter+1)/g_numBinSplits) yiter++;
+
+	return g_binGroups[xiter + yiter * g_numBinSplits];
+}
+
+// Hand the tail the search found to ApplySearchResults. If the search came up empty, keep the old target
+// unless someone else took it, then the head goes to ResolveFallbackSearches.
+void SetNearestNeighbor(NodeIndex index, NodeIndex nearest)
+{
+	if (nearest != NodeIndex(-1)) g_foundTargets[index] = nearest;
+	else if (IsValidTarget(TargetIndex(index), index) == false)
+		g_fallbackSearches[g_numFallbackSearches++] = index;
+}
+
+HRESULT FindNearestNeighbor(const BinGroup& group, NodeIndex index)
+{
+	HRESULT hr = S_OK;
+
+	if (g_nodes.attribs[index].hasParent == true)
+		return S_FALSE;
+
+	short2 position = GetPosition(index);
+	float2 pos = {position.getX(), position.getY()};
+	if (Bin(group, pos.x, pos.y, nullptr) != S_OK)
+		return S_FALSE; // if we're not in a bin backed by memory, just keep our old neighbor
+
+	int xrange[2] = {int(pos.x/g_binNWidth - 0.5f), int(pos.x/g_binNWidth + 0.5f)};
+	int yrange[2] = {int(pos.y/g_binNHeight - 0.5f), int(pos.y/g_binNHeight + 0.5f)};
+
+	int searched[2][2] = {{1, 0}, {1, 0}}; // The bins the last ring covered, x then y. Empty at first.
+	uint rings = 0;
+	uint maxRings = IsValidTarget(TargetIndex(index), index) ? uint(-1) : MAX_SEARCH_RINGS; // A head that keeps its target never goes to the fallback
+	uint minDist = -1;
+	NodeIndex nearest = -1;
+	int bin;
+	do {
+		// Only the bins the ring grew by. The ones inside were searched already, and seeing them again
+		// can't change the result, but it made a search that expands to the whole group cubic.
+		for (int y = yrange[0]; y <= yrange[1]; y++)
+		{
+			bool searchedRow = y >= searched[1][0] && y <= searched[1][1];
+			for (int x = xrange[0]; x <= xrange[1]; x++)
+			{
+				if (searchedRow && x == searched[0][0])
+				{
+					x = searched[0][1];
+					continue;
+				}
+
+				IFC( Bin(group, x, y, &bin) ); // Bin fails if the bin isn't memory backed, the ranges stay inside the group
+
+				for (uint slot = 0; slot < group.stride; slot++)
+				{
+					// TODO: These large strides are going to kill the cache! 
+					//		 We should probably switch to storing the node indexes linearly with the MSb denoting end of bucket
+					//		 Then we'd have a separate table to index into this based on bucket
+					// No, that won't work because inserts would be very difficult/expensive. The easiest way would be a linked
+					//	   list, but that would obviously be super slow. I think I the first try was actually the best ;D
+					NodeIndex target = group.slots[bin*group.stride + slot];
+					if (target == EMPTY_SLOT)
+						break;
+					else if (IsValidTarget(target, index))
+					{
+						uint dist = Distance(position, GetPosition(target));
+						if (dist < minDist)
+						{
+							minDist = dist;
+							nearest = target;
+						}
+					}
+				}
+			}
+		}
+		memcpy(searched[0], xrange, sizeof(xrange));
+		memcpy(searched[1], yrange, sizeof(yrange));
+		if (xrange[0] > group.rangeX[0]) xrange[0]--;
+		if (xrange[1] < group.rangeX[1]) xrange[1]++;
+		if (yrange[0] > group.rangeY[0]) yrange[0]--;
+		if (yrange[1] < group.rangeY[1]) yrange[1]++;
+
+		// Do we need this? Could happen if a vert is in a quadrant of it's own
+		if (xrange[1] - xrange[0] == group.rangeX[1] - group.rangeX[0] && 
+			yrange[1] - yrange[0] == group.rangeY[1] - group.rangeY[0])
+			break;
+		if (++rings > maxRings)
+			break;
+
+	} while (nearest == NodeIndex(-1));
+
+	SetNearestNeighbor(index, nearest);
+	hr = S_OK; // Boundary bins come back as S_BOUNDARY
+
+Cleanup:
+	return hr;
+}
+
+inline uint ScreenBin(const ScreenGrid& grid, short2 position)
+{
+	return BinIndex(uint(position.getX() / grid.nWidth), uint(position.getY() / grid.nHeight), grid.countX, grid.morton);
+}
+
+// Check one tail against the best found so far
+inline void ConsiderTarget(NodeIndex target, NodeIndex index, short2 position, uint* minDist, NodeIndex* nearest)
+{
+	if (IsValidTarget(target, index))
+	{
+		uint dist = Distance(position, GetPosition(target));
+		if (dist < *minDist)
+		{
+			*minDist = dist;
+			*nearest = target;
+		}
+	}
+}
+
+void VisitCsrBin(uint bin, NodeIndex index, short2 position, uint* minDist, NodeIndex* nearest)
+{
+	for (uint slot = g_csrStart[bin]; slot < g_csrStart[bin+1]; slot++)
+		ConsiderTarget(g_csrSlots[slot], index, position, minDist, nearest);
+}
+
+void VisitPersistentBin(uint bin, NodeIndex index, short2 position, uint* minDist, NodeIndex* nearest)
+{
+	for (NodeIndex id = g_gridHeads[bin]; id != EMPTY_SLOT; id = g_gridNext[id])
+		ConsiderTarget(g_idToIndex[id], index, position, minDist, nearest);
+}
+
+typedef void (*VisitBinFunc)(uint bin, NodeIndex index, short2 position, uint* minDist, NodeIndex* nearest);
+
+// Whole screen grid version of the search: the same expanding rings as FindNearestNeighbor, but never
+// limited to a bin group. VisitBin walks the tails in one bin.
+template <VisitBinFunc VisitBin>
+HRESULT FindNearestNeighbor(const ScreenGrid& grid, NodeIndex index)
+{
+	if (g_nodes.attribs[index].hasParent == true)
+		return S_FALSE;
+
+	short2 position = GetPosition(index);
+	float2 pos = {position.getX(), position.getY()};
+	const int lastX = int(grid.countX) - 1;
+	const int lastY = int(grid.countY) - 1;
+
+	int xrange[2] = {int(pos.x/grid.nWidth - 0.5f), int(pos.x/grid.nWidth + 0.5f)};
+	int yrange[2] = {int(pos.y/grid.nHeight - 0.5f), int(pos.y/grid.nHeight + 0.5f)};
+	if (xrange[0] < 0) xrange[0] = 0;
+	if (yrange[0] < 0) yrange[0] = 0;
+	if (xrange[1] > lastX) xrange[1] = lastX;
+	if (yrange[1] > lastY) yrange[1] = lastY;
+
+	int searched[2][2] = {{1, 0}, {1, 0}}; // The bins the last ring covered, x then y
+	uint rings = 0;
+	uint maxRings = IsValidTarget(TargetIndex(index), index) ? uint(-1) : MAX_SEARCH_RINGS; // A head that keeps its target never goes to the fallback
+	uint minDist = -1;
+	NodeIndex nearest = -1;
+	do {
+		for (int y = yrange[0]; y <= yrange[1]; y++)
+		{
+			bool searchedRow = y >= searched[1][0] && y <= searched[1][1];
+			for (int x = xrange[0]; x <= xrange[1]; x++)
+			{
+				if (searchedRow && x == searched[0][0])
+					x = searched[0][1];
+				else
+					VisitBin(BinIndex(x, y, grid.countX, grid.morton), index, position, &minDist, &nearest);
+			}
+		}
+
+		memcpy(searched[0], xrange, sizeof(xrange));
+		memcpy(searched[1], yrange, sizeof(yrange));
+		if (xrange[0] == 0 && yrange[0] == 0 && xrange[1] == lastX && yrange[1] == lastY)
+			break;
+		if (++rings > maxRings)
+			break;
+		if (xrange[0] > 0) xrange[0]--;
+		if (xrange[1] < lastX) xrange[1]++;
+		if (yrange[0] > 0) yrange[0]--;
+		if (yrange[1] < lastY) yrange[1]++;
+
+	} while (nearest == NodeIndex(-1));
+
+	SetNearestNeighbor(index, nearest);
+	return S_OK;
+}
+
+// Size the bins for the current number of active nodes and split them into the bin groups
+void UpdateBinLayout()
+{
+	float pixelsPerVert = float(g_width * g_height) / g_numActiveNodes; // Integer division hits 0 past ~800K nodes
+	float binDiameterPixels = sqrt(pixelsPerVert); // conservative
+
+	g_binNHeight = binDiameterPixels / g_height;
+	g_binNWidth  = binDiameterPixels / g_width;
+
+	g_binCountX  = uint(ceilf(1.0f / g_binNWidth) )+2;  // Add a boundary around the outside
+	g_binCountY  = uint(ceilf(1.0f / g_binNHeight))+2;
+
+	for (uint i = 0; i < g_numBinSplits*g_numBinSplits; i++)
+	{
+		BinGroup& group = g_binGroups[i];
+		uint xiter = i % g_numBinSplits;
+		uint yiter = i / g_numBinSplits;
+		group.rangeX[0] = (g_binCountX * xiter/g_numBinSplits)		   - 1;	// Subtract/Add 1 to each of these ranges for a buffer layer
+		group.rangeX[1] = (g_binCountX * (xiter+1)/g_numBinSplits - 1) + 1;	// This buffer layer will be overlap for each quadrant
+		group.rangeY[0] = (g_binCountY * yiter/g_numBinSplits)		   - 1;	// But without it verts would only target verts in their quadrant
+		group.rangeY[1] = (g_binCountY * (yiter+1)/g_numBinSplits - 1) + 1;
+		group.morton = g_mortonBins;
+		group.stride = g_numSlots / BinCount(group.rangeX[1] - group.rangeX[0] + 1, group.rangeY[1] - group.rangeY[0] + 1, group.morton);
+		group.slots = g_slots[i];
+	}
+}
+
+// Bin all the chompable tails that fall into one group (halo included) into the group's slots
+void BinTailsTask(uint groupIndex, void*)
+{
+	const BinGroup& group = g_binGroups[groupIndex];
+
+	int bin;
+	memset(group.slots, 0xFF, sizeof(g_slots[0])); // Every slot to EMPTY_SLOT
+	g_binGroups[groupIndex].dropped = 0;
+	for (uint tail = 0; tail < g_numTails; tail++)
+	{
+		NodeIndex i = g_idToIndex[g_tails[tail]];
+		short2 position = GetPosition(i);
+		HRESULT hrbin = Bin(group, position.getX(), position.getY(), &bin);
+		if (FAILED(hrbin)) // If this bin isn't backed by memory, we can't be a target this frame
+			continue;
+
+		// Find first empty bin slot
+		uint slot;
+		for (slot = 0; slot < group.stride; slot++) 
+		{
+			if (group.slots[bin*group.stride + slot] == EMPTY_SLOT)
+			{
+				group.slots[bin*group.stride + slot] = i;
+				break;
+			}
+		}
+		// If we overflow the bins, the vertex cannot be targeted. GRID_CSR doesn't have this problem.
+		if (slot == group.stride)
+			g_binGroups[groupIndex].dropped++;
+	}
+}
+
+uint GetDroppedTails()
+{
+	uint dropped = 0;
+	if (g_tailEngine == ENGINE_GRID && g_gridLayout == GRID_STRIDE)
+	{
+		for (uint i = 0; i < g_numBinSplits*g_numBinSplits; i++)
+			dropped += g_binGroups[i].dropped;
+	}
+	return dropped;
+}
+
+// Size a whole screen grid for SCREEN_TAILS_PER_BIN tails per bin. The bins grow if the window shape
+// asks for more than maxBins.
+void SizeScreenGrid(ScreenGrid* grid, uint maxBins)
+{
+	float pixelsPerBin = float(g_width * g_height) * SCREEN_TAILS_PER_BIN / g_numActiveNodes;
+	float binDiameterPixels = sqrt(pixelsPerBin);
+
+	for (;;)
+	{
+		grid->nHeight = binDiameterPixels / g_height;
+		grid->nWidth  = binDiameterPixels / g_width;
+		grid->countX  = uint(1.0f / grid->nWidth) + 1; // Positions go all the way to 1.0
+		grid->countY  = uint(1.0f / grid->nHeight) + 1;
+		grid->morton  = g_mortonBins;
+		if (BinCount(grid->countX, grid->countY, grid->morton) <= maxBins)
+			break;
+		binDiameterPixels *= 1.25f;
+	}
+}
+
+// The CSR bin offsets and the sorted tails have to share g_slots
+void UpdateCsrLayout()
+{
+	SizeScreenGrid(&g_csrGrid, sizeof(g_slots) / sizeof(NodeIndex) - g_numNodes - 1);
+
+	g_csrStart = &g_slots[0][0];
+	g_csrSlots = g_csrStart + BinCount(g_csrGrid.countX, g_csrGrid.countY, g_csrGrid.morton) + 1;
+}
+
+// Count the tails in each bin, prefix sum the counts into offsets, then scatter the tails into place
+void BuildCsrGrid()
+{
+	uint numBins = BinCount(g_csrGrid.countX, g_csrGrid.countY, g_csrGrid.morton);
+
+	memset(g_csrStart, 0, (numBins + 1) * sizeof(NodeIndex));
+	for (uint tail = 0; tail < g_numTails; tail++)
+		g_csrStart[ScreenBin(g_csrGrid, GetPosition(g_idToIndex[g_tails[tail]])) + 1]++;
+
+	for (uint bin = 0; bin < numBins; bin++)
+		g_csrStart[bin + 1] += g_csrStart[bin];
+
+	// Scatter using g_csrStart[bin] as the bin's write cursor. That leaves every entry at the
+	// start of the next bin, so shift them all back up by one afterwards.
+	for (uint tail = 0; tail < g_numTails; tail++)
+	{
+		NodeIndex i = g_idToIndex[g_tails[tail]];
+		g_csrSlots[g_csrStart[ScreenBin(g_csrGrid, GetPosition(i))]++] = i;
+	}
+	memmove(g_csrStart + 1, g_csrStart, numBins * sizeof(NodeIndex));
+	g_csrStart[0] = 0;
+}
+
+// Size the persistent grid for the current number of snakes and insert every tail
+void RebuildPersistentGrid()
+{
+	SizeScreenGrid(&g_persistentGrid, g_numNodes);
+
+	memset(g_gridHeads, 0xFF, sizeof(g_gridHeads));
+	memset(g_gridBin, 0xFF, sizeof(g_gridBin));
+	for (uint tail = 0; tail < g_numTails; tail++)
+		GridInsert(g_tails[tail], ScreenBin(g_persistentGrid, GetPosition(g_idToIndex[g_tails[tail]])));
+
+	g_numGridMoves = 0;
+	g_gridBuiltFor = g_numActiveNodes;
+}
+
+// Move the tails that crossed a bin boundary since the last frame
+void UpdatePersistentGrid()
+{
+	if (g_gridBuiltFor == 0 || g_numActiveNodes * 2 <= g_gridBuiltFor || g_persistentGrid.morton != g_mortonBins)
+	{
+		RebuildPersistentGrid();
+		return;
+	}
+
+	for (uint move = 0; move < g_numGridMoves; move++)
+	{
+		NodeIndex id = g_gridMoves[move];
+		if (g_gridBin[id] == EMPTY_SLOT)
+			continue; // Eaten after it moved
+
+		uint bin = ScreenBin(g_persistentGrid, GetPosition(g_idToIndex[id]));
+		if (bin != g_gridBin[id])
+		{
+			GridRemove(id);
+			GridInsert(id, bin);
+		}
+	}
+	g_numGridMoves = 0;
+
+#ifdef _DEBUG
+	for (uint i = 0; i < g_numNodes; i++)
+	{
+		NodeIndex id = g_indexToId[i];
+		NodeIndex bin = g_nodes.attribs[i].hasChild ? EMPTY_SLOT : ScreenBin(g_persistentGrid, GetPosition(i));
+		ASSERT(g_gridBin[id] == bin);
+	}
+#endif
+}
+
+// Stop maintaining the persistent grid, the next UpdatePersistentGrid rebuilds it
+void InvalidatePersistentGrid()
+{
+	g_gridBuiltFor = 0;
+	g_numGridMoves = 0;
+}
+
+// Bin this frame's tails in the current grid layout
+void BuildGrid()
+{
+	if (g_gridLayout == GRID_CSR)
+	{
+		UpdateCsrLayout();
+		BuildCsrGrid();
+	}
+	else if (g_gridLayout == GRID_PERSISTENT)
+	{
+		UpdatePersistentGrid();
+	}
+	else
+	{
+		UpdateBinLayout();
+		ParallelFor(g_numBinSplits*g_numBinSplits, BinTailsTask, nullptr);
+	}
+}
+
+// Find a new target for one node in the current grid layout. With the stride layout, the head is
+// searched in the group that holds it.
+void SearchGrid(NodeIndex i)
+{
+	if (g_gridLayout == GRID_CSR)
+	{
+		FindNearestNeighbor<VisitCsrBin>(g_csrGrid, i);
+	}
+	else if (g_gridLayout == GRID_PERSISTENT)
+	{
+		FindNearestNeighbor<VisitPersistentBin>(g_persistentGrid, i);
+	}
+	else
+	{
+		float posx = GetPosition(i).getX();
+		float posy = GetPosition(i).getY();
+		const BinGroup& group = GetBinGroup(posx, posy);
+		if (S_OK == Bin(group, posx, posy, nullptr))
+		{
+			FindNearestNeighbor(group, i);
+		}
+	}
+}
+
+// k-d tree over this frame's tails (ENGINE_KDTREE). It is implicit and balanced: the median of a range
+// [begin, end) sits at (begin + end) / 2, with the smaller half before it and the larger after, split on x
+// at even depths and on y at odd ones. Positions are copied next to the indexes so the search doesn't have
+// to touch g_nodes until it has a candidate.
+#define KD_PARALLEL_DEPTH 3 // The top levels are split serially, the 2^KD_PARALLEL_DEPTH subtrees below in parallel
+
+NodeIndex g_kdIndex[g_numNodes];
+ushort g_kdX[g_numNodes];
+ushort g_kdY[g_numNodes];
+uint g_kdCount = 0;
+
+inline ushort KdCoord(uint i, uint axis)
+{
+	return axis ? g_kdY[i] : g_kdX[i];
+}
+
+inline void KdSwap(uint a, uint b)
+{
+	NodeIndex index = g_kdIndex[a]; g_kdIndex[a] = g_kdIndex[b]; g_kdIndex[b] = index;
+	ushort x = g_kdX[a]; g_kdX[a] = g_kdX[b]; g_kdX[b] = x;
+	ushort y = g_kdY[a]; g_kdY[a] = g_kdY[b]; g_kdY[b] = y;
+}
+
+// Quickselect: leave the k-th smallest coordinate on the axis at k, everything before it <= and after it >=
+void KdSelect(uint begin, uint end, uint k, uint axis)
+{
+	while (end - begin > 1)
+	{
+		// Median of three pivot, then a three way partition so runs of equal coordinates can't stall it
+		ushort a = KdCoord(begin, axis);
+		ushort b = KdCoord(begin + (end - begin) / 2, axis);
+		ushort c = KdCoord(end - 1, axis);
+		ushort pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+
+		uint less = begin;
+		uint greater = end;
+		uint i = begin;
+		while (i < greater)
+		{
+			ushort value = KdCoord(i, axis);
+			if (value < pivot)		KdSwap(less++, i++);
+			else if (value > pivot) KdSwap(i, --greater);
+			else					i++;
+		}
+
+		if (k < less)			end = less;
+		else if (k >= greater)	begin = greater;
+		else					return;
+	}
+}
+
+void KdBuild(uint begin, uint end, uint depth, uint stopDepth)
+{
+	if (end - begin <= 1 || depth == stopDepth)
+		return;
+
+	uint mid = (begin + end) / 2;
+	KdSelect(begin, end, mid, depth & 1);
+	KdBuild(begin, mid, depth + 1, stopDepth);
+	KdBuild(mid + 1, end, depth + 1, stopDepth);
+}
+
+// Build one of the subtrees at KD_PARALLEL_DEPTH. The bits of the task index pick left or right at each level above.
+void KdBuildTask(uint subtree, void*)
+{
+	uint begin = 0;
+	uint end = g_kdCount;
+	for (uint level = 0; level < KD_PARALLEL_DEPTH; level++)
+	{
+		if (end - begin <= 1)
+			return; // This branch ran out of tails higher up
+		uint mid = (begin + end) / 2;
+		if (subtree & (1 << (KD_PARALLEL_DEPTH - 1 - level))) begin = mid + 1;
+		else												 end = mid;
+	}
+	KdBuild(begin, end, KD_PARALLEL_DEPTH, uint(-1));
+}
+
+void BuildKdTree()
+{
+	g_kdCount = g_numTails;
+	for (uint tail = 0; tail < g_numTails; tail++)
+	{
+		NodeIndex i = g_idToIndex[g_tails[tail]];
+		g_kdIndex[tail] = i;
+		g_kdX[tail] = g_nodes.x[i];
+		g_kdY[tail] = g_nodes.y[i];
+	}
+
+	KdBuild(0, g_kdCount, 0, KD_PARALLEL_DEPTH);
+	ParallelFor(1 << KD_PARALLEL_DEPTH, KdBuildTask, nullptr);
+}
+
+struct KdQuery
+{
+	NodeIndex head;
+	int x;
+	int y;
+	uint minDist;
+	NodeIndex nearest;
+};
+
+// Nearest valid tail in [begin, end), near side first. offset[] is how far the query is outside the range's
+// cell on each axis, so the far side is only searched if its cell is closer than the best tail so far.
+// Bounding on one axis alone let a query far from every tail visit most of the tree.
+void KdSearch(KdQuery* query, uint begin, uint end, uint axis, const uint offset[2])
+{
+	uint cell[2] = { offset[0], offset[1] };
+
+	while (begin < end)
+	{
+		uint mid = (begin + end) / 2;
+		int diffx = int(g_kdX[mid]) - query->x;
+		int diffy = int(g_kdY[mid]) - query->y;
+		uint dist = abs(diffx) + abs(diffy);
+		if (dist < query->minDist && IsValidTarget(g_kdIndex[mid], query->head))
+		{
+			query->minDist = dist;
+			query->nearest = g_kdIndex[mid];
+		}
+
+		int split = axis ? diffy : diffx; // Positive if we're on the smaller side
+		if (split > 0)
+		{
+			KdSearch(query, begin, mid, axis ^ 1, cell);
+			begin = mid + 1;
+		}
+		else
+		{
+			KdSearch(query, mid + 1, end, axis ^ 1, cell);
+			end = mid;
+		}
+		cell[axis] = abs(split); // The near side holds the query's coordinate, so this only grows
+		if (cell[0] + cell[1] >= query->minDist)
+			return;
+		axis ^= 1;
+	}
+}
+
+void SearchKdTree(NodeIndex i)
+{
+	if (g_nodes.attribs[i].hasParent == true)
+		return;
+
+	KdQuery query = { i, g_nodes.x[i], g_nodes.y[i], uint(-1), NodeIndex(-1) };
+	const uint inside[2] = { 0, 0 };
+	KdSearch(&query, 0, g_kdCount, 0, inside);
+	SetNearestNeighbor(i, query.nearest);
+}
+
+void FallbackSearchTask(uint taskIndex, void*)
+{
+	uint begin = taskIndex * FALLBACKS_PER_TASK;
+	uint end = begin + FALLBACKS_PER_TASK < g_numFallbackSearches ? begin + FALLBACKS_PER_TASK : uint(g_numFallbackSearches);
+
+	for (uint entry = begin; entry < end; entry++)
+	{
+		NodeIndex index = g_fallbackSearches[entry];
+		KdQuery query = { index, g_nodes.x[index], g_nodes.y[index], uint(-1), NodeIndex(-1) };
+		const uint inside[2] = { 0, 0 };
+		KdSearch(&query, 0, g_kdCount, 0, inside);
+		ASSERT(query.nearest != NodeIndex(-1)); // There's always another snake before the endgame
+		g_foundTargets[index] = query.nearest;
+	}
+}
+
+// Search the queued heads over every tail. This replaced an O(N) scan per head, which made a frame
+// with many isolated heads quadratic.
+void ResolveFallbackSearches()
+{
+	if (g_tailEngine != ENGINE_KDTREE)
+		BuildKdTree();
+
+	ParallelFor((g_numFallbackSearches + FALLBACKS_PER_TASK - 1) / FALLBACKS_PER_TASK, FallbackSearchTask, nullptr);
+
+	AddToCounter(COUNTER_FALLBACK_SEARCHES, g_numFallbackSearches);
+	g_numFallbackSearches = 0;
+}
+
+// A nearest tail engine indexes the frame's tails once (Build, timed as binning), then answers
+// "nearest valid tail to this head" for any number of heads in parallel (Search).
+struct TailEngineFuncs
+{
+	void (*Build)();
+	void (*Search)(NodeIndex head);
+};
+
+static const TailEngineFuncs s_tailEngines[ENGINE_COUNT] =
+{
+	{ BuildGrid,	SearchGrid },	// ENGINE_GRID
+	{ BuildKdTree,	SearchKdTree }, // ENGINE_KDTREE
+};
+
+inline void SearchNode(NodeIndex i)
+{
+	s_tailEngines[g_tailEngine].Search(i);
+}
+
+// Find new targets for a run of g_heads. The results go to g_foundTargets, nothing writes g_nodes
+// while the searches run.
+void FindNeighborsTask(uint taskIndex, void*)
+{
+	uint begin = taskIndex * NODES_PER_SEARCH_TASK;
+	uint end = begin + NODES_PER_SEARCH_TASK < g_numHeads ? begin + NODES_PER_SEARCH_TASK : g_numHeads;
+
+	for (uint head = begin; head < end; head++)
+		SearchNode(g_idToIndex[g_heads[head]]);
+}
+
+// Point a run of g_heads at the tails their searches found. Each task only touches its own heads.
+void ApplySearchResultsTask(uint taskIndex, void*)
+{
+	uint begin = taskIndex * NODES_PER_SEARCH_TASK;
+	uint end = begin + NODES_PER_SEARCH_TASK < g_numHeads ? begin + NODES_PER_SEARCH_TASK : g_numHeads;
+
+	for (uint head = begin; head < end; head++)
+	{
+		NodeIndex index = g_idToIndex[g_heads[head]];
+		if (g_foundTargets[index] != EMPTY_SLOT)
+		{
+			g_nodes.attribs[index].targetID = g_indexToId[g_foundTargets[index]];
+			g_foundTargets[index] = EMPTY_SLOT;
+		}
+	}
+}
+
+// Only heads are searched, so every result belongs to one of g_heads
+void ApplySearchResults()
+{
+	ParallelFor((g_numHeads + NODES_PER_SEARCH_TASK - 1) / NODES_PER_SEARCH_TASK, ApplySearchResultsTask, nullptr);
+}
+
+inline bool SearchScheduling()
+{
+	return g_searchFraction < 1.0f || g_searchBudgetUs != 0;
+}
+
+// Search one task's worth of urgent or round robin heads, unless the frame's budget is spent
+void SearchScheduledTask(uint taskIndex, void*)
+{
+	g_searchTaskDone[taskIndex] = false;
+	if (g_searchDeadline && GetTicks() > g_searchDeadline)
+		return;
+
+	if (taskIndex < g_numUrgentTasks)
+	{
+		uint begin = taskIndex * SEARCHES_PER_BUDGETED_TASK;
+		uint end = begin + SEARCHES_PER_BUDGETED_TASK < g_numUrgentSearches ? begin + SEARCHES_PER_BUDGETED_TASK : g_numUrgentSearches;
+
+		for (uint entry = begin; entry < end; entry++)
+			SearchNode(g_idToIndex[g_urgentSearches[entry]]);
+	}
+	else
+	{
+		uint begin = (taskIndex - g_numUrgentTasks) * SEARCHES_PER_BUDGETED_TASK;
+		uint end = begin + SEARCHES_PER_BUDGETED_TASK < g_searchQuota ? begin + SEARCHES_PER_BUDGETED_TASK : g_searchQuota;
+
+		// Urgent heads are searched by their own task, a second search of the same head would race with it
+		for (uint k = begin; k < end; k++)
+		{
+			NodeIndex id = g_heads[(g_searchCursor + k) % g_numHeads];
+			if (!g_urgentQueued[id])
+				SearchNode(g_idToIndex[id]);
+		}
+	}
+
+	g_searchTaskDone[taskIndex] = true;
+}
+
+// Link every head under its target, or queue it if the target is dead. Used when scheduling starts.
+void BuildPursuers()
+{
+	memset(g_firstPursuer, 0xFF, sizeof(g_firstPursuer));
+	memset(g_pursuedTail, 0xFF, sizeof(g_pursuedTail));
+	memset(g_urgentQueued, 0, sizeof(g_urgentQueued));
+	g_numUrgentSearches = 0;
+
+	for (uint head = 0; head < g_numHeads; head++)
+	{
+		NodeIndex id = g_heads[head];
+		NodeIndex index = g_idToIndex[id];
+		if (IsValidTarget(TargetIndex(index), index)) LinkPursuer(id, g_nodes.attribs[index].targetID);
+		else										  QueueUrgentSearch(id);
+	}
+	g_pursuersValid = true;
+}
+
+// Stop maintaining the pursuer lists, the next scheduled frame rebuilds them
+void InvalidatePursuers()
+{
+	g_pursuersValid = false;
+	g_numUrgentSearches = 0;
+}
+
+// Move a searched head into the pursuer list of its (maybe new) target
+void RelinkPursuer(NodeIndex id)
+{
+	NodeIndex index = g_idToIndex[id];
+	if (g_nodes.attribs[index].hasParent || g_urgentQueued[id])
+		return; // Not a head anymore, or it's still waiting for its urgent search
+
+	NodeIndex target = g_nodes.attribs[index].targetID;
+	if (g_pursuedTail[id] != target)
+	{
+		UnlinkPursuer(id);
+		LinkPursuer(id, target);
+	}
+}
+
+// Search until the scheduled heads or the budget run out. FinishScheduledSearches sorts out what ran.
+void RunScheduledSearches()
+{
+	if (!g_pursuersValid)
+		BuildPursuers();
+
+	g_searchQuota = uint(g_searchFraction * g_numHeads + 0.5f);
+	if (g_searchQuota < 1) g_searchQuota = 1;
+	if (g_searchQuota > g_numHeads) g_searchQuota = g_numHeads;
+
+	g_numUrgentTasks = (g_numUrgentSearches + SEARCHES_PER_BUDGETED_TASK - 1) / SEARCHES_PER_BUDGETED_TASK;
+	g_numScheduledTasks = g_numUrgentTasks + (g_searchQuota + SEARCHES_PER_BUDGETED_TASK - 1) / SEARCHES_PER_BUDGETED_TASK;
+
+	g_searchDeadline = g_searchBudgetUs ? GetTicks() + g_searchBudgetUs * GetTickFrequency() / 1000000 : 0;
+	ParallelFor(g_numScheduledTasks, SearchScheduledTask, nullptr);
+}
+
+// After the fallback searches: relink every head that was searched, keep the urgent heads the budget cut
+// off for next frame, and move the round robin cursor up to the first task that didn't run, so those
+// heads go first next frame.
+void FinishScheduledSearches()
+{
+	uint kept = 0;
+	for (uint task = 0; task < g_numUrgentTasks; task++)
+	{
+		uint begin = task * SEARCHES_PER_BUDGETED_TASK;
+		uint end = begin + SEARCHES_PER_BUDGETED_TASK < g_numUrgentSearches ? begin + SEARCHES_PER_BUDGETED_TASK : g_numUrgentSearches;
+
+		for (uint entry = begin; entry < end; entry++)
+		{
+			NodeIndex id = g_urgentSearches[entry];
+			if (g_searchTaskDone[task])
+			{
+				g_urgentQueued[id] = false;
+				RelinkPursuer(id);
+			}
+			else
+			{
+				g_urgentSearches[kept++] = id;
+			}
+		}
+	}
+	g_numUrgentSearches = kept;
+
+	uint searched = g_searchQuota;
+	for (uint task = g_numUrgentTasks; task < g_numScheduledTasks; task++)
+	{
+		uint begin = (task - g_numUrgentTasks) * SEARCHES_PER_BUDGETED_TASK;
+		uint end = begin + SEARCHES_PER_BUDGETED_TASK < g_searchQuota ? begin + SEARCHES_PER_BUDGETED_TASK : g_searchQuota;
+
+		if (g_searchTaskDone[task] == false)
+		{
+			if (searched == g_searchQuota)
+				searched = begin;
+			continue;
+		}
+		for (uint k = begin; k < end; k++)
+			RelinkPursuer(g_heads[(g_searchCursor + k) % g_numHeads]);
+	}
+	g_searchCursor = (g_searchCursor + searched) % g_numHeads;
+
+#ifdef _DEBUG
+	for (uint head = 0; head < g_numHeads; head++)
+	{
+		NodeIndex id = g_heads[head];
+		NodeIndex index = g_idToIndex[id];
+		bool linked = g_pursuedTail[id] == g_nodes.attribs[index].targetID && IsValidTarget(TargetIndex(index), index);
+		ASSERT(g_urgentQueued[id] || linked);
+	}
+#endif
+}
+
+
+// Lower the tail's claim to index. The lowest claim wins whatever order the claims come in.
+inline void ClaimTail(NodeIndex tail, NodeIndex index)
+{
+	NodeIndex claim = g_tailClaims[tail].load(std::memory_order_relaxed);
+	while (index < claim && !g_tailClaims[tail].compare_exchange_weak(claim, index, std::memory_order_relaxed))
+		;
+}
+
+// Move the nodes of one task towards their targets: heads chase at speed, children follow their parent.
+// Nodes go through in batches of POSITION_BATCH. Positions are gathered into float staging arrays,
+// the math runs SIMD_WIDTH lanes at a time, and the results are written back in order.
+// All nodes in a batch see their targets' positions from before the batch. With one thread and without
+// g_doubleBuffer targets are read in place, so the ones in earlier batches have already moved. Otherwise
+// every node reads its target from before the frame (g_prevX/g_prevY), since another task may be writing it.
+// With chain ordering every child's parent is the node right before it, so only the heads read out of order.
+// Nothing here changes the snakes, heads in reach only claim their target (see g_tailClaims).
+void UpdatePositionsTask(uint task, void*)
+{
+	const uint begin = task * POSITION_TASK_NODES;
+	const uint end = begin + POSITION_TASK_NODES < g_numNodes ? begin + POSITION_TASK_NODES : g_numNodes;
+	const float step = g_positionStep;
+	const bool streaming = g_chainOrder && g_chainsContiguous;
+	const bool trackBins = g_gridBuiltFor != 0;
+	const ushort* readX = g_readPrevPositions ? g_prevX : g_nodes.x;
+	const ushort* readY = g_readPrevPositions ? g_prevY : g_nodes.y;
+	uint numClaims = 0;
+	uint numMoves = 0;
+
+	float curX[POSITION_BATCH], curY[POSITION_BATCH];
+	float targetX[POSITION_BATCH], targetY[POSITION_BATCH];
+	float follow[POSITION_BATCH]; // Nonzero for children, they follow their parent instead of chasing
+	float dist[POSITION_BATCH];
+	int newX[POSITION_BATCH], newY[POSITION_BATCH];
+
+	const floatv scale = SetV(MAX_USHORTF);
+	const floatv half = SetV(0.5f);
+	const floatv zero = SetV(0.0f);
+	const floatv tailDist = SetV(g_tailDist); // This controls wigglyness. Perhaps it should be a function of velocity? (static is more wiggly)
+	const floatv speedStep = SetV(step);
+
+	for (uint base = begin; base < end; base += POSITION_BATCH)
+	{
+		uint count = end - base < POSITION_BATCH ? end - base : POSITION_BATCH;
+
+		// Gather. The target reads are the only random accesses.
+		for (uint k = 0; k < POSITION_BATCH; k++)
+		{
+			uint i = base + (k < count ? k : 0); // Pad a short batch with copies of the first node
+			bool child = g_nodes.attribs[i].hasParent;
+			NodeIndex target = (streaming && child) ? i - 1 : TargetIndex(i);
+			curX[k] = g_nodes.x[i];
+			curY[k] = g_nodes.y[i];
+			targetX[k] = readX[target];
+			targetY[k] = readY[target];
+			follow[k] = child ? 1.0f : 0.0f;
+		}
+
+		for (uint k = 0; k < POSITION_BATCH; k += SIMD_WIDTH)
+		{
+			// For optimal precision, pull our shorts into floats and do all math at full precision...
+			floatv cx = Div(LoadV(curX + k), scale);
+			floatv cy = Div(LoadV(curY + k), scale);
+			floatv vx = Sub(Div(LoadV(targetX + k), scale), cx);
+			floatv vy = Sub(Div(LoadV(targetY + k), scale), cy);
+
+			floatv lengthSq = Add(Mul(vx, vx), Mul(vy, vy));
+			floatv length = Sqrt(lengthSq);
+			floatv nonzero = CmpNEQ(length, zero);
+			floatv dirx = Select(nonzero, Div(vx, length), vx);
+			floatv diry = Select(nonzero, Div(vy, length), vy);
+
+			// Children: stay tailDist behind the parent
+			floatv followX = Sub(vx, Mul(dirx, tailDist));
+			floatv followY = Sub(vy, Mul(diry, tailDist));
+
+			// Heads: move at speed, but don't overshoot the target
+			floatv stepX = Mul(dirx, speedStep);
+			floatv stepY = Mul(diry, speedStep);
+			floatv arrive = CmpLT(lengthSq, Add(Mul(stepX, stepX), Mul(stepY, stepY)));
+			floatv chaseX = Select(arrive, vx, stepX);
+			floatv chaseY = Select(arrive, vy, stepY);
+
+			floatv isChild = CmpNEQ(LoadV(follow + k), zero);
+			floatv offsetX = Select(isChild, followX, chaseX);
+			floatv offsetY = Select(isChild, followY, chaseY);
+
+			// ... then finally, at the verrrry end, stuff our FP floats into 16-bit shorts
+			// (the 0.5 is for rounding, same as short2::setX)
+			StoreV(newX + k, TruncateToInt(Add(Mul(Add(cx, offsetX), scale), half)));
+			StoreV(newY + k, TruncateToInt(Add(Mul(Add(cy, offsetY), scale), half)));
+			StoreV(dist + k, length);
+		}
+
+		for (uint k = 0; k < count; k++)
+		{
+			uint i = base + k;
+			g_nodes.x[i] = ushort(newX[k]);
+			g_nodes.y[i] = ushort(newY[k]);
+
+			// Queue tails that left their bin in the persistent grid
+			if (trackBins && g_nodes.attribs[i].hasChild == false)
+			{
+				NodeIndex id = g_indexToId[i];
+				if (ScreenBin(g_persistentGrid, GetPosition(i)) != g_gridBin[id])
+					g_gridMoves[begin + numMoves++] = id;
+			}
+
+			// Check for chomps. A head that reached its target's position chomps it too: both ends of a
+			// chase read the positions from before the batch, so two heads chasing each other could
+			// otherwise swap places every frame forever.
+			if (g_nodes.attribs[i].hasParent == false && (dist[k] <= g_tailDist || dist[k] < step))
+			{
+				NodeIndex target = TargetIndex(i);
+				if (IsValidTarget(target, i))
+				{
+					ClaimTail(g_indexToId[target], i);
+					g_chompClaims[begin + numClaims++] = i;
+				}
+			}
+		}
+	}
+
+	g_numTaskClaims[task] = numClaims;
+	g_numTaskMoves[task] = numMoves;
+}
+
+// Pack the tasks' ranges of values together, in task order. Returns the total.
+uint GatherTaskRanges(NodeIndex* values, const uint* counts, uint numTasks)
+{
+	uint total = 0;
+	for (uint task = 0; task < numTasks; task++)
+	{
+		memmove(values + total, values + task * POSITION_TASK_NODES, counts[task] * sizeof(NodeIndex));
+		total += counts[task];
+	}
+	return total;
+}
+
+// Chomp for the heads that won their claim, in storage order. Chomp() checks the target again: an earlier
+// chomp this frame can have made it the winner's own tail. Then the claim is released to the claimants after
+// the winner, the next of them gets the tail, same as in a serial loop. The claims are cleared for next frame.
+void ResolveChomps(uint numTasks)
+{
+	uint numClaims = GatherTaskRanges(g_chompClaims, g_numTaskClaims, numTasks);
+
+	for (uint claim = 0; claim < numClaims; claim++)
+	{
+		NodeIndex i = g_chompClaims[claim];
+		std::atomic<NodeIndex>& tailClaim = g_tailClaims[g_nodes.attribs[i].targetID];
+		NodeIndex winner = tailClaim.load(std::memory_order_relaxed);
+		if (winner != i && winner != EMPTY_SLOT)
+			continue; // Lost to an earlier head, which got the tail
+
+		int active = g_numActiveNodes;
+		Chomp(i);
+		tailClaim.store(g_numActiveNodes != active ? i : EMPTY_SLOT, std::memory_order_relaxed);
+	}
+	for (uint claim = 0; claim < numClaims; claim++)
+		g_tailClaims[g_nodes.attribs[g_chompClaims[claim]].targetID].store(EMPTY_SLOT, std::memory_order_relaxed);
+}
+
+// Every node moves, then the frame's chomps happen
+void UpdatePositions(float step)
+{
+	const uint numTasks = (g_numNodes + POSITION_TASK_NODES - 1) / POSITION_TASK_NODES;
+
+	ASSERT(g_numGridMoves == 0);
+	g_positionStep = step;
+	g_readPrevPositions = g_doubleBuffer || GetWorkerCount() > 1;
+	if (g_readPrevPositions)
+	{
+		memcpy(g_prevX, g_nodes.x, sizeof(g_prevX));
+		memcpy(g_prevY, g_nodes.y, sizeof(g_prevY));
+	}
+	ParallelFor(numTasks, UpdatePositionsTask, nullptr);
+
+	if (g_gridBuiltFor)
+		g_numGridMoves = GatherTaskRanges(g_gridMoves, g_numTaskMoves, numTasks);
+	ResolveChomps(numTasks);
+}
+
+template <typename T>
+void Reverse(T* values, uint begin, uint end)
+{
+	while (begin + 1 < end)
+	{
+		end--;
+		T temp = values[begin];
+		values[begin] = values[end];
+		values[end] = temp;
+		begin++;
+	}
+}
+
+// Move the nodes in storage [middle, end) in front of [begin, middle), in place
+void RotateNodes(uint begin, uint middle, uint end)
+{
+	Reverse(g_nodes.x, begin, middle);			Reverse(g_nodes.x, middle, end);		   Reverse(g_nodes.x, begin, end);
+	Reverse(g_nodes.y, begin, middle);			Reverse(g_nodes.y, middle, end);		   Reverse(g_nodes.y, begin, end);
+	Reverse(g_nodes.attribs, begin, middle);	Reverse(g_nodes.attribs, middle, end);	   Reverse(g_nodes.attribs, begin, end);
+	Reverse(g_indexToId, begin, middle);		Reverse(g_indexToId, middle, end);		   Reverse(g_indexToId, begin, end);
+
+	for (uint i = begin; i < end; i++)
+		g_idToIndex[g_indexToId[i]] = i;
+}
+
+// True if the node's parent is stored right before it, i.e. it continues the snake in front of it
+inline bool FollowsParent(uint index)
+{
+	return index > 0 && g_nodes.attribs[index].hasParent && TargetIndex(index) == index - 1;
+}
+
+// Storage is reordered by gathering each array through order[], using temp as scratch
+template <typename T>
+void Permute(T* values, const NodeIndex* order, T* temp)
+{
+	for (uint i = 0; i < g_numNodes; i++)
+		temp[i] = values[order[i]];
+	memcpy(values, temp, g_numNodes * sizeof(T));
+}
+
+// Z-order cell of a position on a grid of 2^MORTON_ORDER_BITS cells per side
+inline uint MortonKey(short2 position)
+{
+	const uint shift = 16 - MORTON_ORDER_BITS;
+	return SpreadBits(position.x >> shift) | (SpreadBits(position.y >> shift) << 1);
+}
+
+// Counting sort g_heads by MortonKey into the last g_numHeads entries of order[]
+void SortHeadsMorton(NodeIndex* order)
+{
+	static uint s_cellStart[(1 << (2 * MORTON_ORDER_BITS)) + 1];
+	const uint numCells = countof(s_cellStart) - 1;
+	NodeIndex* heads = order + g_numNodes - g_numHeads;
+
+	memset(s_cellStart, 0, sizeof(s_cellStart));
+	for (uint head = 0; head < g_numHeads; head++)
+		s_cellStart[MortonKey(GetPosition(g_idToIndex[g_heads[head]])) + 1]++;
+	for (uint cell = 0; cell < numCells; cell++)
+		s_cellStart[cell + 1] += s_cellStart[cell];
+
+	for (uint head = 0; head < g_numHeads; head++)
+	{
+		NodeIndex i = g_idToIndex[g_heads[head]];
+		heads[s_cellStart[MortonKey(GetPosition(i))]++] = i;
+	}
+}
+
+// Lay every snake out contiguously from scratch, in O(N). Uses g_slots as scratch memory.
+// With g_mortonOrder the snakes go in Z-order of their heads, so heads that search the same bins sit
+// near each other in storage. Otherwise they keep their current order.
+void ReorderChains()
+{
+	static_assert(sizeof(g_slots) >= 2 * g_numNodes * sizeof(NodeIndex), "g_slots is too small for the reorder scratch");
+	static_assert(sizeof(Attribs) <= sizeof(NodeIndex), "Permute scratch is sized for NodeIndex");
+
+	NodeIndex* order = &g_slots[0][0];
+	NodeIndex* child = order + g_numNodes;
+
+	ASSERT(!g_endgame);
+
+	for (uint i = 0; i < g_numNodes; i++)
+		child[i] = EMPTY_SLOT;
+	for (uint i = 0; i < g_numNodes; i++)
+	{
+		if (g_nodes.attribs[i].hasParent)
+			child[TargetIndex(i)] = i;
+	}
+
+	// Every head, followed by its body down to the tail
+	uint count = 0;
+	if (g_mortonOrder)
+	{
+		// The sorted heads sit at the end of order[]. Every snake is at least as long as its head,
+		// so writing the snakes out from the front never overtakes the heads still to be read.
+		SortHeadsMorton(order);
+
+		for (uint head = g_numNodes - g_numHeads; head < g_numNodes; head++)
+		{
+			for (NodeIndex chain = order[head]; chain != EMPTY_SLOT; chain = child[chain])
+				order[count++] = chain;
+		}
+	}
+	else
+	{
+		for (uint i = 0; i < g_numNodes; i++)
+		{
+			if (g_nodes.attribs[i].hasParent) continue;
+			for (NodeIndex chain = i; chain != EMPTY_SLOT; chain = child[chain])
+				order[count++] = chain;
+		}
+	}
+	ASSERT(count == g_numNodes);
+
+	// child[] isn't needed anymore, it becomes the scratch for the gathers
+	Permute(g_nodes.x, order, (ushort*)child);
+	Permute(g_nodes.y, order, (ushort*)child);
+	Permute(g_nodes.attribs, order, (Attribs*)child);
+	Permute(g_indexToId, order, child);
+
+	for (uint i = 0; i < g_numNodes; i++)
+		g_idToIndex[g_indexToId[i]] = i;
+
+	g_chainsContiguous = true;
+	g_framesSinceReorder = 0;
+}
+
+// Join the snakes of this frame's chomps in storage: the eater's block moves next to the tail it bit,
+// or the other way around if that moves fewer nodes. Snakes in between slide over as whole blocks.
+// Incremental moves cost the distance between the two snakes, so after moving more than g_numNodes
+// nodes in one frame we give up and do a full ReorderChains instead.
+void ApplyChainJoins()
+{
+	uint moved = 0;
+
+	for (uint join = 0; join < g_numPendingJoins; join++)
+	{
+		uint head = g_idToIndex[g_pendingJoins[join]];
+		uint tail = TargetIndex(head);
+
+		if (tail + 1 == head)
+			continue; // Already in place
+
+		uint headEnd = head + 1;
+		while (headEnd < g_numNodes && FollowsParent(headEnd)) headEnd++;
+		uint tailStart = tail;
+		while (FollowsParent(tailStart)) tailStart--;
+		uint tailEnd = tail + 1;
+
+		if (moved > g_numNodes)
+		{
+			g_chainsContiguous = false;
+			break;
+		}
+
+		if (head < tail)
+		{
+			RotateNodes(head, headEnd, tailEnd);
+			moved += tailEnd - head;
+		}
+		else if (headEnd - tailEnd <= head - tailStart)
+		{
+			RotateNodes(tailEnd, head, headEnd);
+			moved += headEnd - tailEnd;
+		}
+		else
+		{
+			RotateNodes(tailStart, tailEnd, head);
+			moved += head - tailStart;
+		}
+	}
+	g_numPendingJoins = 0;
+
+	if (!g_chainsContiguous)
+		ReorderChains();
+
+#ifdef _DEBUG
+	for (uint i = 0; i < g_numNodes; i++)
+		ASSERT(!g_nodes.attribs[i].hasParent || FollowsParent(i));
+#endif
+}
+
+HRESULT Update(double deltaTime)
+{
+	HRESULT hr = S_OK;
+
+	BeginPhase(PHASE_UPDATE);
+
+	if (g_tailEngine != ENGINE_GRID || g_gridLayout != GRID_PERSISTENT)
+		InvalidatePersistentGrid();
+
+	if (g_endgame)
+	{
+		BeginPhase(PHASE_ENDGAME);
+		hr = EndgameUpdate(deltaTime);
+		EndPhase(PHASE_ENDGAME);
+		goto Cleanup;
+	}
+
+	ASSERT(g_numHeads == uint(g_numActiveNodes) && g_numTails == g_numHeads); // One of each per snake
+
+	// Chain ordering was just switched on, or was off while snakes joined. Morton order also re-sorts
+	// every so often, the chomps only keep the snakes contiguous.
+	if (g_chainOrder && (!g_chainsContiguous || (g_mortonOrder && ++g_framesSinceReorder >= MORTON_REORDER_FRAMES)))
+	{
+		BeginPhase(PHASE_CHAIN_ORDER);
+		ReorderChains();
+		EndPhase(PHASE_CHAIN_ORDER);
+	}
+
+	// Sort into buckets (or whatever the nearest tail engine does)
+	BeginPhase(PHASE_BINNING);
+	s_tailEngines[g_tailEngine].Build();
+	EndPhase(PHASE_BINNING);
+
+	// Determine nearest neighbors
+	BeginPhase(PHASE_NEAREST_NEIGHBOR);
+	if (SearchScheduling())
+	{
+		RunScheduledSearches();
+	}
+	else
+	{
+		InvalidatePursuers(); // Every head gets searched, nothing needs to know who's chasing what
+		ParallelFor((g_numHeads + NODES_PER_SEARCH_TASK - 1) / NODES_PER_SEARCH_TASK, FindNeighborsTask, nullptr);
+	}
+	if (g_numFallbackSearches)
+	{
+		BeginPhase(PHASE_FALLBACK_SEARCH);
+		ResolveFallbackSearches();
+		EndPhase(PHASE_FALLBACK_SEARCH);
+	}
+	ApplySearchResults();
+	if (SearchScheduling())
+		FinishScheduledSearches();
+	EndPhase(PHASE_NEAREST_NEIGHBOR);
+
+	BeginPhase(PHASE_POSITION_UPDATE);
+	UpdatePositions(float(g_speed * deltaTime));
+	EndPhase(PHASE_POSITION_UPDATE);
+
+	if (g_numPendingJoins)
+	{
+		BeginPhase(PHASE_CHAIN_ORDER);
+		ApplyChainJoins();
+		EndPhase(PHASE_CHAIN_ORDER);
+	}
+
+Cleanup:
+	if (!g_endgame && g_numActiveNodes == 1)
+		hr = EndgameInit();
+
+	EndPhase(PHASE_UPDATE);
+	EndProfileFrame();
+
+	return hr;
+}
+
+// 64-bit FNV-1a over every node's position and attributes, in node ID order so chain ordering doesn't
+// change it, and the number of snakes. Runs with the same options and seed only match if this does.
+uint64 StateChecksum()
+{
+	uint64 hash = 14695981039346656037ull;
+	for (uint id = 0; id < g_numNodes; id++)
+	{
+		NodeIndex i = g_idToIndex[id];
+		Attribs attribs = g_nodes.attribs[i];
+		uint64 node = g_nodes.x[i] | (uint64(g_nodes.y[i]) << 16) | (uint64(attribs.hasParent) << 32) |
+					  (uint64(attribs.hasChild) << 33) | (uint64(attribs.targetID) << 34);
+		hash = (hash ^ node) * 1099511628211ull;
+	}
+	hash = (hash ^ uint64(g_numActiveNodes)) * 1099511628211ull;
+	return (hash ^ uint64(g_endgame)) * 1099511628211ull;
+}
+
+// Everything Update() reads that isn't rebuilt from the nodes, options included. The persistent grid is
+// saved too, a rebuilt one would list the tails in another order. The pursuer lists aren't, loading rebuilds
+// them and their order doesn't change any results.
+struct SavedScalars
+{
+	ScreenGrid persistentGrid;
+	int gridBuiltFor;
+	uint numGridMoves;
+	uint width, height;
+	float speed;
+	float searchFraction;
+	uint searchBudgetUs;
+	uint tailEngine, gridLayout;
+	int numActiveNodes;
+	uint numHeads, numTails;
+	uint numLinks, linkRound, worldRound;
+	uint framesSinceReorder;
+	uint searchCursor;
+	uint randomSeed;
+	double endgameTime;
+	bool endgame, chainsContiguous;
+	bool chainOrder, mortonBins, mortonOrder, doubleBuffer;
+};
+
+struct SavedArray
+{
+	void* data;
+	uint size;
+};
+
+static const SavedArray s_savedArrays[] =
+{
+	{ &g_nodes, sizeof(g_nodes) },
+	{ g_idToIndex, sizeof(g_idToIndex) },
+	{ g_indexToId, sizeof(g_indexToId) },
+	{ g_snakeEnd, sizeof(g_snakeEnd) },
+	{ g_heads, sizeof(g_heads) },
+	{ g_tails, sizeof(g_tails) },
+	{ g_headSlot, sizeof(g_headSlot) },
+	{ g_tailSlot, sizeof(g_tailSlot) },
+	{ g_links, sizeof(g_links) },
+	{ g_gridHeads, sizeof(g_gridHeads) },
+	{ g_gridNext, sizeof(g_gridNext) },
+	{ g_gridBin, sizeof(g_gridBin) },
+	{ g_gridMoves, sizeof(g_gridMoves) },
+};
+
+uint SimulationStateSize()
+{
+	uint size = sizeof(SavedScalars);
+	for (uint i = 0; i < countof(s_savedArrays); i++)
+		size += s_savedArrays[i].size;
+	return size;
+}
+
+void SaveSimulationState(void* state)
+{
+	SavedScalars scalars;
+	memset(&scalars, 0, sizeof(scalars)); // No uninitialized padding in the file
+	scalars.persistentGrid = g_persistentGrid;
+	scalars.gridBuiltFor = g_gridBuiltFor;
+	scalars.numGridMoves = g_numGridMoves;
+	scalars.width = g_width;
+	scalars.height = g_height;
+	scalars.speed = g_speed;
+	scalars.searchFraction = g_searchFraction;
+	scalars.searchBudgetUs = g_searchBudgetUs;
+	scalars.tailEngine = g_tailEngine;
+	scalars.gridLayout = g_gridLayout;
+	scalars.numActiveNodes = g_numActiveNodes;
+	scalars.numHeads = g_numHeads;
+	scalars.numTails = g_numTails;
+	scalars.numLinks = g_numLinks;
+	scalars.linkRound = g_linkRound;
+	scalars.worldRound = g_worldRound;
+	scalars.framesSinceReorder = g_framesSinceReorder;
+	scalars.searchCursor = g_searchCursor;
+	scalars.randomSeed = g_randomSeed;
+	scalars.endgameTime = g_endgameTime;
+	scalars.endgame = g_endgame;
+	scalars.chainsContiguous = g_chainsContiguous;
+	scalars.chainOrder = g_chainOrder;
+	scalars.mortonBins = g_mortonBins;
+	scalars.mortonOrder = g_mortonOrder;
+	scalars.doubleBuffer = g_doubleBuffer;
+
+	char* out = (char*)state;
+	memcpy(out, &scalars, sizeof(scalars));
+	out += sizeof(scalars);
+	for (uint i = 0; i < countof(s_savedArrays); i++)
+	{
+		memcpy(out, s_savedArrays[i].data, s_savedArrays[i].size);
+		out += s_savedArrays[i].size;
+	}
+}
+
+void LoadSimulationState(const void* state)
+{
+	SavedScalars scalars;
+	const char* in = (const char*)state;
+	memcpy(&scalars, in, sizeof(scalars));
+	in += sizeof(scalars);
+	for (uint i = 0; i < countof(s_savedArrays); i++)
+	{
+		memcpy(s_savedArrays[i].data, in, s_savedArrays[i].size);
+		in += s_savedArrays[i].size;
+	}
+
+	g_persistentGrid = scalars.persistentGrid;
+	g_gridBuiltFor = scalars.gridBuiltFor;
+	g_numGridMoves = scalars.numGridMoves;
+	g_width = scalars.width;
+	g_height = scalars.height;
+	g_speed = scalars.speed;
+	g_searchFraction = scalars.searchFraction;
+	g_searchBudgetUs = scalars.searchBudgetUs;
+	g_tailEngine = TailEngine(scalars.tailEngine);
+	g_gridLayout = GridLayout(scalars.gridLayout);
+	g_numActiveNodes = scalars.numActiveNodes;
+	g_numHeads = scalars.numHeads;
+	g_numTails = scalars.numTails;
+	g_numLinks = scalars.numLinks;
+	g_linkRound = scalars.linkRound;
+	g_worldRound = scalars.worldRound;
+	g_framesSinceReorder = scalars.framesSinceReorder;
+	g_searchCursor = scalars.searchCursor;
+	g_randomSeed = scalars.randomSeed;
+	g_endgameTime = scalars.endgameTime;
+	g_endgame = scalars.endgame;
+	g_chainsContiguous = scalars.chainsContiguous;
+	g_chainOrder = scalars.chainOrder;
+	g_mortonBins = scalars.mortonBins;
+	g_mortonOrder = scalars.mortonOrder;
+	g_doubleBuffer = scalars.doubleBuffer;
+
+	g_numPendingJoins = 0;
+	InvalidatePursuers();
+}
+
+#define EXPLOSION_BATCH 64 // Nodes per HashPairs call in ExplosionTask. Multiple of SIMD_WIDTH.
+
+// Move POSITION_TASK_NODES nodes along their explosion velocities. A node's velocity is a hash of its storage
+// index, which doesn't change during the explosion, so nothing has to be stored and no two nodes share one.
+// Positions go straight from g_nodes into SIMD registers and back. A short batch at the end runs the same
+// math one node at a time.
+void ExplosionTask(uint task, void*)
+{
+	const uint begin = task * POSITION_TASK_NODES;
+	const uint end = begin + POSITION_TASK_NODES < g_numNodes ? begin + POSITION_TASK_NODES : g_numNodes;
+	const float step = g_explosionStep * MAX_USHORTF; // Top speed this frame, in ushort space
+
+	float velX[EXPLOSION_BATCH], velY[EXPLOSION_BATCH]; // [0, 1), for -1..1 times the top speed
+
+	const floatv half = SetV(0.5f);
+	const floatv one = SetV(1.0f);
+	const floatv two = SetV(2.0f);
+	const floatv stepV = SetV(step);
+
+	uint base = begin;
+	for (; base + EXPLOSION_BATCH <= end; base += EXPLOSION_BATCH)
+	{
+		HashPairs(g_explosionKey, base, EXPLOSION_BATCH, velX, velY);
+
+		// Nodes that fly off one edge come back on the other, like they always did
+		for (uint k = 0; k < EXPLOSION_BATCH; k += SIMD_WIDTH)
+		{
+			floatv offsetX = Mul(Sub(Mul(LoadV(velX + k), two), one), stepV);
+			floatv offsetY = Mul(Sub(Mul(LoadV(velY + k), two), one), stepV);
+			StoreUshortV(g_nodes.x + base + k, Add(Add(LoadUshortV(g_nodes.x + base + k), offsetX), half));
+			StoreUshortV(g_nodes.y + base + k, Add(Add(LoadUshortV(g_nodes.y + base + k), offsetY), half));
+		}
+	}
+
+	for (uint i = base; i < end; i++)
+	{
+		float x, y;
+		HashPair(g_explosionKey, i, &x, &y);
+		g_nodes.x[i] = ushort(int(float(g_nodes.x[i]) + (x*2.0f - 1.0f) * step + 0.5f));
+		g_nodes.y[i] = ushort(int(float(g_nodes.y[i]) + (y*2.0f - 1.0f) * step + 0.5f));
+	}
+}
+
+HRESULT EndgameUpdate(double deltaTime)
+{
+	const float timeLimit = 5.0f; // 5 seconds
+	const float maxVelocity = 0.5f; // Screens per second
+
+	g_endgameTime += deltaTime;
+
+	// Every node eases from its velocity down to 0 over timeLimit, all with the same factor
+	g_explosionStep = SmoothStep(maxVelocity, 0.0f, float(g_endgameTime)/timeLimit) * float(deltaTime);
+	g_explosionKey = Philox(g_randomSeed, RandomStream(RANDOM_EXPLOSION, g_linkRound - g_worldRound), 0).x;
+	ParallelFor((g_numNodes + POSITION_TASK_NODES - 1) / POSITION_TASK_NODES, ExplosionTask, nullptr);
+
+	if (g_endgameTime > timeLimit)
+	{
+		g_endgame = false;
+		g_numActiveNodes = g_numNodes;
+		g_chainsContiguous = true; // Back to single segments, any order will do
+		g_endgameTime = 0;
+
+		for (uint i = 0; i < g_numNodes; i++)
+		{
+			g_nodes.attribs[i].hasChild = false;
+			g_nodes.attribs[i].hasParent = false;
+			g_snakeEnd[i] = i;
+		}
+		RebuildNodeLists();
+
+		// Every node is a tail again
+		if (g_gridLayout == GRID_PERSISTENT)
+			RebuildPersistentGrid();
+	}
+
+	return S_OK;
+}
+
+#define RANDOM_TASK_BATCH 256 // Random pairs made at a time by InitPositionsTask
+
+HRESULT EndgameInit()
+{
+	g_endgame = true;
+	InvalidatePersistentGrid(); // Nothing is chasing, so nothing needs the grid until the reset
+	InvalidatePursuers();
+	g_numLinks = 0;
+	g_linkRound++;
+
+	//// TODO: Add "shaking" before we explode. The snake should continue
+	////		 to swim along, then start vibrating, then EXPLODE.
+
+	return S_OK;
+}
+
+// Random starting positions for POSITION_TASK_NODES nodes. Nothing has moved yet, so IDs are storage indexes.
+// The world only depends on g_randomSeed, however many worlds this process made before.
+void InitPositionsTask(uint task, void*)
+{
+	const uint stream = RandomStream(RANDOM_WORLD, 0);
+	float x[RANDOM_TASK_BATCH];
+	float y[RANDOM_TASK_BATCH];
+
+	uint end = (task + 1) * POSITION_TASK_NODES < g_numNodes ? (task + 1) * POSITION_TASK_NODES : g_numNodes;
+	for (uint begin = task * POSITION_TASK_NODES; begin < end; begin += RANDOM_TASK_BATCH)
+	{
+		uint count = end - begin < RANDOM_TASK_BATCH ? end - begin : RANDOM_TASK_BATCH;
+		RandomPairs(g_randomSeed, stream, begin, count, x, y);
+		for (uint i = 0; i < count; i++)
+			SetPosition(begin + i, x[i], y[i]);
+	}
+}
+
+// Seed the world with separated single-segment snakes at random positions
+HRESULT InitSimulation()
+{
+	g_endgame = false;
+	g_numActiveNodes = g_numNodes;
+	g_numPendingJoins = 0;
+	g_chainsContiguous = true;
+	InvalidatePersistentGrid();
+	g_searchCursor = 0;
+	InvalidatePursuers();
+	g_numLinks = 0;
+	g_linkRound++; // Still a new round for renderers and replication, whose links have to start over
+	g_worldRound = g_linkRound;
+
+	memset(&g_nodes, 0, sizeof(g_nodes));
+	memset(g_foundTargets, 0xFF, sizeof(g_foundTargets));
+	for (uint i = 0; i < g_numNodes; i++)
+	{
+		g_idToIndex[i] = g_indexToId[i] = g_snakeEnd[i] = i;
+		g_nodes.attribs[i].targetID = i; // Stay put until a search finds a real target
+		g_tailClaims[i].store(EMPTY_SLOT, std::memory_order_relaxed);
+	}
+	ParallelFor((g_numNodes + POSITION_TASK_NODES - 1) / POSITION_TASK_NODES, InitPositionsTask, nullptr);
+	RebuildNodeLists();
+
+	return S_OK;
+}
+
+uint Distance(short2 current, short2 target)
+{
+	int diffx = abs(int(current.x - target.x));
+	int diffy = abs(int(current.y - target.y));
+	int dist = diffx + diffy; // Manhattan distance
+	ASSERT(dist >= 0); // dist < 0 means overflow
+	return dist;
+}
+
+// Smoothly blend between a and b based on t
+float SmoothStep(float a, float b, float t)
+{
+	return a + (pow(t,2)*(3-2*t))*(b - a);
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+// The snake simulation, with no dependencies on windowing or GL.
+// Main.cpp drives it from WinMain and renders g_nodes, Server.cpp drives it headless.
+
+#include "Platform.h"
+#include <math.h>   // sqrt
+#include <string.h> // memset
+#include <stdlib.h> // abs
+#include "Types.h"  // float2, short2, Attribs
+
+#define S_BOUNDARY	0x20000001
+#define E_NOTARGETS 0xA0000002
+#define EMPTY_SLOT NodeIndex(-1)
+
+// Number of nodes is a build option. Anything above MAX_NODE_COUNT needs FLOWSNAKE_WIDE_INDEX.
+#ifndef FLOWSNAKE_NUM_NODES
+#	ifdef FLOWSNAKE_WIDE_INDEX
+#		define FLOWSNAKE_NUM_NODES 1048576
+#	else
+#		define FLOWSNAKE_NUM_NODES 16000
+#	endif
+#endif
+
+/********** Global Constants***********************/
+const uint g_numNodes = FLOWSNAKE_NUM_NODES; // Number of nodes (vertices / snake segments) in the scene
+const uint g_numSlots = g_numNodes / 2;		 // Number of slots (indexes to nodes) avaiable for spatial binning
+const float g_tailDist = 0.001f; // Distance that children will stay from their parents (in 0..1 space)
+extern float g_speed;			  // in Screens per second
+
+// How tails are binned for the nearest neighbor search
+enum GridLayout
+{
+	GRID_STRIDE,	 // A fixed number of slots per bin in each bin group. Tails that land in a full bin are dropped.
+	GRID_CSR,		 // Counting sort into compact [begin, end) bins. Nothing gets dropped.
+	GRID_PERSISTENT, // Per-bin lists kept across frames. Only tails that cross a bin boundary get moved.
+};
+
+// What answers "nearest valid tail to this head"
+enum TailEngine
+{
+	ENGINE_GRID,   // Ring search over the bins of g_gridLayout
+	ENGINE_KDTREE, // k-d tree over the tails, rebuilt every frame
+	ENGINE_COUNT
+};
+
+/********** Globals Variables *********************/
+extern uint g_width;  // The world's aspect ratio (and bin sizing) follows the window size
+extern uint g_height;
+
+extern uint g_randomSeed;	   // Key for all the random numbers (Random.h), a new seed makes new worlds
+extern int g_numActiveNodes;   // Number of head nodes that are actively seeking tails to chomp
+extern bool g_endgame;
+extern bool g_chainOrder;	   // Keep every snake contiguous in storage, head first. Can be switched at any time.
+extern TailEngine g_tailEngine; // Can be switched at any time
+extern GridLayout g_gridLayout; // Only used by ENGINE_GRID. Can be switched at any time.
+extern bool g_mortonBins;	   // Z-order the grid bins in memory (see BinIndex). Can be switched at any time.
+extern bool g_mortonOrder;	   // With g_chainOrder, lay the snakes out in Z-order of their heads
+extern bool g_doubleBuffer;	   // Move every node towards where its target was last frame even with one thread,
+							   // so the results are the same for any thread count. More than one thread always
+							   // does. Can be switched at any time.
+
+// Targets don't need re-searching every frame. Each frame searches the heads whose target was taken,
+// then g_searchFraction of the rest in round robin order, stopping once g_searchBudgetUs is spent.
+// The defaults search every head every frame. A budget makes the results depend on timing.
+extern float g_searchFraction;
+extern uint g_searchBudgetUs; // 0 for no limit
+
+// Nodes are stored as a structure of arrays, so the position update can stream x and y
+// straight into SIMD registers. Positions are 0..1 in 16-bit fixed point, like short2.
+struct NodeArrays
+{
+	ushort x[g_numNodes];
+	ushort y[g_numNodes];
+	Attribs attribs[g_numNodes];
+};
+
+extern NodeArrays g_nodes;
+
+// g_nodes is indexed by storage index, which changes when chain ordering moves snakes around.
+// Node IDs never change: targetID holds an ID, and anything outside the simulation should too.
+extern NodeIndex g_idToIndex[g_numNodes];
+extern NodeIndex g_indexToId[g_numNodes];
+extern NodeIndex g_snakeEnd[g_numNodes]; // By ID, the ID of the other end of each snake's head and tail
+
+// Every link chomped this round, in order, as node ID pairs: the eater, then the tail it bit.
+// For renderers that keep their own copy of the snakes. Emptied (and g_linkRound bumped) when the big
+// snake explodes and by InitSimulation. A round has fewer chomps than nodes, so it can't overflow.
+extern NodeIndex g_links[2 * g_numNodes];
+extern uint g_numLinks;
+extern uint g_linkRound;
+
+// Spread the low 16 bits of v out to the even bits
+inline uint SpreadBits(uint v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// Bins are tiled 8x8 in Morton (Z) order, the tiles themselves row-major. Whole Z-order over the grid
+// would waste up to 3/4 of the bins on padding, the tiles waste at most the partial tiles on the edges.
+#define MORTON_TILE_BITS 3
+#define MORTON_TILE (1 << MORTON_TILE_BITS)
+
+// Memory index of bin (x, y) in a grid width bins wide. Row-major unless morton, where the bins of a
+// small neighbourhood share cache lines instead of sitting a whole row apart.
+inline uint BinIndex(uint x, uint y, uint width, bool morton)
+{
+	if (!morton)
+		return x + y * width;
+
+	uint tilesX = (width + MORTON_TILE - 1) >> MORTON_TILE_BITS;
+	uint tile = (y >> MORTON_TILE_BITS) * tilesX + (x >> MORTON_TILE_BITS);
+	return (tile << (2 * MORTON_TILE_BITS)) | SpreadBits(x & (MORTON_TILE - 1)) | (SpreadBits(y & (MORTON_TILE - 1)) << 1);
+}
+
+// Number of bins BinIndex can return for a width x height grid, padding included
+inline uint BinCount(uint width, uint height, bool morton)
+{
+	if (!morton)
+		return width * height;
+
+	uint tilesX = (width + MORTON_TILE - 1) >> MORTON_TILE_BITS;
+	uint tilesY = (height + MORTON_TILE - 1) >> MORTON_TILE_BITS;
+	return (tilesX * tilesY) << (2 * MORTON_TILE_BITS);
+}
+
+inline short2 GetPosition(NodeIndex i)
+{
+	short2 position = {g_nodes.x[i], g_nodes.y[i]};
+	return position;
+}
+
+inline void SetPosition(NodeIndex i, float x, float y)
+{
+	short2 position;
+	position.setX(x);
+	position.setY(y);
+	g_nodes.x[i] = position.x;
+	g_nodes.y[i] = position.y;
+}
+
+/********** Function Declarations *****************/
+HRESULT InitSimulation();
+HRESULT Update(double deltaTime);
+HRESULT EndgameUpdate(double deltaTime);
+HRESULT EndgameInit();
+void RebuildNodeLists(); // Call after changing hasParent/hasChild outside the simulation
+uint GetDroppedTails(); // Tails the last binning pass couldn't fit in the grid
+uint64 StateChecksum();	// Hash of the whole simulation state, to compare runs frame by frame
+// Snapshot of everything Update() depends on, the options included, for recordings (see Recording.h).
+// Loading one and calling Update() gives the same frames the saved run got after saving it.
+uint SimulationStateSize();
+void SaveSimulationState(void* state); // state must hold SimulationStateSize() bytes
+void LoadSimulationState(const void* state);
+uint Distance(short2 current, short2 target);
+float SmoothStep(float a, float b, float t);
@@ -1,141 +1,533 @@
-//const uint g_numNodes = 16000;
-//extern Node g_nodes[g_numNodes];
-//extern bool g_endgame;
-//extern short g_numActiveNodes;
-//
-//extern float frand();
-//extern HRESULT Update(double deltaTime);
-
-LARGE_INTEGER freqTime;
-
-Counter nearestNeighborCounter;
-Counter binningCounter;
-Counter positionUpdate;
-Counter updateTime;
-
-inline void BeginCounter(Counter* counter)
-{
-	QueryPerformanceCounter(&counter->start);
-}
-
-inline void EndCounter(Counter* counter)
-{
-	QueryPerformanceCounter(&counter->end);
-}
-
-double GetCounter(Counter& counter)
-{
-	return double(counter.end.QuadPart - counter.start.QuadPart) / freqTime.QuadPart;
-}
-
-void testFirstUpdate()
-{
-	const uint numUpdateLoops = 100;
-
-	double aveDeltaTime = 0;
-	double aveBinning = 0;
-	double aveNN = 0;
-	double avePos = 0;
-
-	// Each run starts with a new set of initial random positions
-	// But each test pass will have the same set of initial position sets
-	for (uint i = 0; i < numUpdateLoops; i++)
-	{
-		BeginCounter(&updateTime);
-		Update(0.016);
-		EndCounter(&updateTime);
-
-		if (i >= 10) // Skip the first c iterations to warm it up a bit
-		{
-			aveDeltaTime += GetCounter(updateTime);
-			aveBinning += GetCounter(binningCounter);
-			aveNN += GetCounter(nearestNeighborCounter);
-			avePos += GetCounter(positionUpdate);
-		}
-		
-		// Reset the sim after each pass (always start with seperated nodes)
-		memset(g_nodes, 0, sizeof(g_nodes));
-		for (uint i = 0; i < g_numNodes; i++)
-		{
-			g_nodes[i].position.setX(frand()*2 - 1);
-			g_nodes[i].position.setY(frand()*2 - 1);
-		}
-	}
-	
-	printf("------------- Initial Update() Test ---------------------\n");
-	printf("Average Update duration = %.3f ms\n", aveDeltaTime/numUpdateLoops * 1000.0f); 
-	printf("Average Binning duration = %.3f ms\n", aveBinning/numUpdateLoops * 1000.0f); 
-	printf("Average Nearest Neighbor duration = %.3f ms\n", aveNN/numUpdateLoops * 1000.0f); 
-	printf("Average Position Update duration = %.3f ms\n", avePos/numUpdateLoops * 1000.0f); 
-}
-
-void testSim()
-{
-	uint i = 0;
-
-	double aveDeltaTime = 0;
-	double aveBinning = 0;
-	double aveNN = 0;
-	double avePos = 0;
-
-	Counter simTime;
-	LARGE_INTEGER frameTime;
-	LARGE_INTEGER prevFrameTime;
-	
-
-	// Set up our initial state
-	memset(g_nodes, 0, sizeof(g_nodes));
-	for (uint i = 0; i < g_numNodes; i++)
-	{
-		g_nodes[i].position.setX(frand()*2 - 1);
-		g_nodes[i].position.setY(frand()*2 - 1);
-	}
-	
-	g_numActiveNodes = g_numNodes;
-	BeginCounter(&simTime);
-	for (i = 0; g_endgame == false && g_numActiveNodes > 1; i++)
-	{
-		double runningAve = 0.001;
-		
-		__int64 elapsed;
-
-		QueryPerformanceCounter(&frameTime);
-        elapsed = frameTime.QuadPart - prevFrameTime.QuadPart;
-        prevFrameTime = frameTime;
-
-		BeginCounter(&updateTime);
-		Update(double(elapsed) / freqTime.QuadPart);
-		EndCounter(&updateTime);
-
-		aveDeltaTime += GetCounter(updateTime);
-		aveBinning += GetCounter(binningCounter);
-		aveNN += GetCounter(nearestNeighborCounter);
-		avePos += GetCounter(positionUpdate);
-
-		runningAve = 0.9*runningAve + 0.1*GetCounter(updateTime);
-
-		if ( i % 1000 == 0)
-		{
-			printf("Num Active Verts: %u\n", g_numActiveNodes);
-			printf("Average Update Time: %lf ms\n", runningAve * 1000.0f);
-		}
-	}
-	EndCounter(&simTime);
-	
-	printf("------------- Simulation Update() Test ---------------------\n");
-	printf("Simulation completion time: %.3f sec\n", GetCounter(simTime));
-	printf("Average Update duration = %.3f ms\n", aveDeltaTime/i * 1000.0f); 
-	printf("Average Binning duration = %.3f ms\n", aveBinning/i * 1000.0f); 
-	printf("Average Nearest Neighbor duration = %.3f ms\n", aveNN/i * 1000.0f); 
-	printf("Average Position Update duration = %.3f ms\n", avePos/i * 1000.0f); 
-}
-
-// Let's set up a reproduceable test environment...
-int testMain (int argc, char* argv[])
-{
-    QueryPerformanceFrequency(&freqTime);
-	testFirstUpdate();
-	//testSim();
-
-	return 0;
-}
+// On Windows this is compiled into Main.cpp by the Test configuration (entry point testMain),
+// on Linux `make test` builds it on its own against libflowsnake.a
+#include "Simulation.h"
+#include "Profiler.h"
+#include "Test.h"
+#include "WorkerPool.h"
+#include "Replication.h"
+#include "Recording.h"
+#include "Random.h"
+#include "Simd.h" // UINTV_WIDTH
+#include <stdio.h>
+
+void testFirstUpdate()
+{
+	const uint numUpdateLoops = 100;
+
+	// The node ID tables are only valid after InitSimulation
+	InitSimulation();
+	// Each run starts from the same initial random positions, they only depend on g_randomSeed
+	for (uint i = 0; i < numUpdateLoops; i++)
+	{
+		if (i == 10) // Skip the first 10 iterations to warm it up a bit
+			ResetProfiler();
+
+		Update(0.016);
+		
+		// Reset the sim after each pass (always start with seperated nodes)
+		InitSimulation();
+	}
+	
+	PrintProfile(stdout, "Initial Update() Test");
+}
+
+void testSim()
+{
+	uint i = 0;
+
+	uint64 freq = GetTickFrequency();
+	uint64 simStart;
+	uint64 prevFrameTime;
+
+	// Set up our initial state
+	InitSimulation();
+	ResetProfiler();
+	
+	simStart = prevFrameTime = GetTicks();
+	for (i = 0; g_endgame == false && g_numActiveNodes > 1; i++)
+	{
+		uint64 frameTime = GetTicks();
+		Update(double(frameTime - prevFrameTime) / freq);
+		prevFrameTime = frameTime;
+
+		if ( i % 1000 == 0)
+		{
+			PhaseStats stats;
+			GetPhaseStats(PHASE_UPDATE, &stats);
+			printf("Num Active Verts: %u\n", g_numActiveNodes);
+			printf("Update Time: p50 %.3f ms, p99 %.3f ms\n", stats.p50, stats.p99);
+		}
+	}
+	
+	printf("Simulation completion time: %.3f sec (%u updates)\n", double(GetTicks() - simStart) / freq, i);
+	PrintProfile(stdout, "Simulation Update() Test");
+}
+
+// The position update late in a round, with and without chain ordered storage
+void testChainOrder()
+{
+	const uint numTicks = 3000;
+
+	for (uint pass = 0; pass < 2; pass++)
+	{
+		g_chainOrder = (pass == 1);
+		InitSimulation();
+
+		for (uint i = 0; i < numTicks; i++)
+		{
+			if (i == numTicks / 2) // Only profile the second half, when the snakes are long
+				ResetProfiler();
+			Update(0.016);
+		}
+
+		printf("%u active snakes after %u ticks\n", g_numActiveNodes, numTicks);
+		PrintProfile(stdout, g_chainOrder ? "Chain Ordered Test" : "Unordered Test");
+	}
+	g_chainOrder = false;
+}
+
+// Stride vs counting sort vs persistent binning over the same run. Build with PROFILE=large NODES=262144 for the 256K numbers.
+void testGridLayouts()
+{
+	const uint numTicks = 1500;
+	const GridLayout layouts[] = { GRID_STRIDE, GRID_CSR, GRID_PERSISTENT };
+	const char* titles[] = { "Stride Grid Test", "CSR Grid Test", "Persistent Grid Test" };
+
+	for (uint pass = 0; pass < countof(layouts); pass++)
+	{
+		uint64 dropped = 0;
+
+		g_gridLayout = layouts[pass];
+		InitSimulation();
+		ResetProfiler();
+
+		for (uint i = 0; i < numTicks; i++)
+		{
+			Update(0.016);
+			dropped += GetDroppedTails();
+		}
+
+		printf("%u nodes, %llu tails dropped from full bins\n", g_numNodes, (unsigned long long)dropped);
+		PrintProfile(stdout, titles[pass]);
+	}
+	g_gridLayout = GRID_STRIDE;
+}
+
+// The nearest tail engines over the same run. Late in a round the tails are sparse and the grid bins get
+// huge, which is where the k-d tree should pay off.
+void testTailEngines()
+{
+	const uint numTicks = 1500;
+	const TailEngine engines[] = { ENGINE_GRID, ENGINE_GRID, ENGINE_KDTREE };
+	const GridLayout layouts[] = { GRID_STRIDE, GRID_CSR, GRID_STRIDE };
+	const char* titles[] = { "Stride Grid Engine Test", "CSR Grid Engine Test", "k-d Tree Engine Test" };
+
+	for (uint pass = 0; pass < countof(engines); pass++)
+	{
+		g_tailEngine = engines[pass];
+		g_gridLayout = layouts[pass];
+		InitSimulation();
+		ResetProfiler();
+
+		for (uint i = 0; i < numTicks; i++)
+			Update(0.016);
+
+		PrintProfile(stdout, titles[pass]);
+	}
+	g_tailEngine = ENGINE_GRID;
+	g_gridLayout = GRID_STRIDE;
+}
+
+// Average number of distinct cache lines the bins within radius of a bin cover, over every bin that
+// has the whole neighbourhood on the grid
+static double NeighbourhoodLines(uint width, uint height, uint bytesPerBin, int radius, bool morton)
+{
+	const uint cacheLine = 64;
+	uint lines[64];
+	uint64 total = 0;
+	uint centers = 0;
+
+	for (int cy = radius; cy < int(height) - radius; cy++)
+	{
+		for (int cx = radius; cx < int(width) - radius; cx++)
+		{
+			uint numLines = 0;
+			for (int y = cy - radius; y <= cy + radius; y++)
+			{
+				for (int x = cx - radius; x <= cx + radius; x++)
+				{
+					uint line = BinIndex(x, y, width, morton) * bytesPerBin / cacheLine;
+					uint seen = 0;
+					while (seen < numLines && lines[seen] != line) seen++;
+					if (seen == numLines && numLines < countof(lines))
+						lines[numLines++] = line;
+				}
+			}
+			total += numLines;
+			centers++;
+		}
+	}
+	return centers ? double(total) / centers : 0.0;
+}
+
+// Row-major vs Z-order bins, then Z-order snakes on top, all chain ordered. Cache misses come from the
+// hardware counter where there is one. The cache lines a neighbourhood scan covers are printed either way.
+void testMortonLayout()
+{
+	const uint numTicks = 1500;
+	const GridLayout layouts[] = { GRID_STRIDE, GRID_CSR };
+	const char* layoutNames[] = { "Stride", "CSR" };
+	const char* orderNames[] = { "Row-Major Bins", "Morton Bins", "Morton Bins and Snakes" };
+	bool haveCounter = SUCCEEDED(OpenCacheMissCounter());
+
+	if (!haveCounter)
+		printf("No hardware cache miss counter\n");
+
+	// A 16K node window at the start of a round has 148x112 stride bins of one slot (2 bytes)
+	for (uint bytesPerBin = 2; bytesPerBin <= 8; bytesPerBin *= 2)
+	{
+		printf("%2u bytes per bin, cache lines per 3x3 / 5x5 scan: row-major %.2f / %.2f, morton %.2f / %.2f\n", bytesPerBin,
+			   NeighbourhoodLines(148, 112, bytesPerBin, 1, false), NeighbourhoodLines(148, 112, bytesPerBin, 2, false),
+			   NeighbourhoodLines(148, 112, bytesPerBin, 1, true), NeighbourhoodLines(148, 112, bytesPerBin, 2, true));
+	}
+
+	g_chainOrder = true;
+	for (uint pass = 0; pass < countof(layouts) * countof(orderNames); pass++)
+	{
+		char title[64];
+		uint order = pass % countof(orderNames);
+
+		g_gridLayout = layouts[pass / countof(orderNames)];
+		g_mortonBins = order >= 1;
+		g_mortonOrder = order >= 2;
+		InitSimulation();
+		ResetProfiler();
+
+		uint64 misses = ReadCacheMisses();
+		for (uint i = 0; i < numTicks; i++)
+			Update(0.016);
+		misses = ReadCacheMisses() - misses;
+
+		if (haveCounter)
+			printf("%.0f cache misses per tick\n", double(misses) / numTicks);
+		sprintf(title, "%s Grid, %s", layoutNames[pass / countof(orderNames)], orderNames[order]);
+		PrintProfile(stdout, title);
+	}
+	CloseCacheMissCounter();
+	g_chainOrder = false;
+	g_gridLayout = GRID_STRIDE;
+	g_mortonBins = false;
+	g_mortonOrder = false;
+}
+
+// The worst case for the fallback search: two segment snakes with every head in the top left bin
+// group and every tail in the bottom right one, so no stride grid search finds anything.
+void testFallbackSearch()
+{
+	const uint numFrames = 20;
+	ResetProfiler();
+
+	for (uint frame = 0; frame < numFrames; frame++)
+	{
+		InitSimulation();
+		for (uint head = 0; head + 1 < g_numNodes; head += 2)
+		{
+			uint tail = head + 1;
+			float x[2], y[2];
+			RandomPair(g_randomSeed, RandomStream(RANDOM_TEST, frame), head, &x[0], &y[0]);
+			RandomPair(g_randomSeed, RandomStream(RANDOM_TEST, frame), tail, &x[1], &y[1]);
+			SetPosition(head, x[0] * 0.4f, y[0] * 0.4f);
+			SetPosition(tail, 0.6f + x[1] * 0.4f, 0.6f + y[1] * 0.4f);
+			g_nodes.attribs[head].hasChild = true;
+			g_nodes.attribs[tail].hasParent = true;
+			g_nodes.attribs[tail].targetID = head;
+			g_snakeEnd[head] = tail;
+			g_snakeEnd[tail] = head;
+		}
+		g_numActiveNodes = g_numNodes / 2;
+		RebuildNodeLists();
+
+		Update(0.016);
+	}
+
+	printf("%llu fallback searches in %u frames\n", (unsigned long long)GetCounterTotal(COUNTER_FALLBACK_SEARCHES), numFrames);
+	PrintProfile(stdout, "Fallback Search Test");
+}
+
+// How the search fraction and budget trade nearest neighbor time for how long the first round takes
+void testSearchScheduling()
+{
+	const uint maxTicks = 10000;
+	const float fractions[] = { 1.0f, 0.25f, 1.0f, 0.25f };
+	const uint budgets[] = { 0, 0, 500, 200 }; // us
+
+	for (uint pass = 0; pass < countof(fractions); pass++)
+	{
+		uint i;
+		char title[64];
+
+		g_searchFraction = fractions[pass];
+		g_searchBudgetUs = budgets[pass];
+		InitSimulation();
+		ResetProfiler();
+
+		for (i = 0; i < maxTicks && g_endgame == false; i++)
+			Update(0.016);
+
+		printf("First round took %u ticks\n", i);
+		sprintf(title, "Search %.0f%%, %u us budget", g_searchFraction * 100.0f, g_searchBudgetUs);
+		PrintProfile(stdout, title);
+	}
+	g_searchFraction = 1.0f;
+	g_searchBudgetUs = 0;
+}
+
+// In place and double buffered position updates on 1, 4 and more than 4 threads (at least one per hardware
+// thread), all from the same start, with the default stride grid. In place reads targets in place only on one
+// thread, so the other two in place runs have to match each other, and the double buffered runs all have to
+// match. Each run stops at the end of the first round. The pool is put back the way it was afterwards.
+void testDoubleBuffer()
+{
+	const uint maxTicks = 10000;
+	const uint oldThreads = GetWorkerCount();
+	static NodeArrays s_start;
+	uint threadCounts[3] = { 1, 4, 5 };
+	uint64 checksums[2][3];
+
+	InitWorkerPool(0);
+	if (GetWorkerCount() > threadCounts[2])
+		threadCounts[2] = GetWorkerCount();
+
+	InitSimulation();
+	memcpy(&s_start, &g_nodes, sizeof(s_start));
+
+	for (uint pass = 0; pass < 6; pass++)
+	{
+		char title[64];
+
+		g_doubleBuffer = pass >= 3;
+		InitWorkerPool(threadCounts[pass % 3]);
+		InitSimulation();
+		memcpy(&g_nodes, &s_start, sizeof(g_nodes));
+		ResetProfiler();
+
+		for (uint i = 0; i < maxTicks && g_endgame == false; i++)
+			Update(0.016);
+
+		checksums[pass / 3][pass % 3] = StateChecksum();
+		printf("%u threads: checksum %016llx\n", GetWorkerCount(), checksums[pass / 3][pass % 3]);
+		sprintf(title, "%s Positions, %u Threads", g_doubleBuffer ? "Double Buffered" : "In Place", GetWorkerCount());
+		PrintProfile(stdout, title);
+	}
+	printf("In place %s on %u and %u threads, double buffered %s on 1, %u and %u threads\n",
+		   checksums[0][1] == checksums[0][2] ? "matches" : "DIFFERS", threadCounts[1], threadCounts[2],
+		   checksums[1][0] == checksums[1][1] && checksums[1][1] == checksums[1][2] ? "matches" : "DIFFERS",
+		   threadCounts[1], threadCounts[2]);
+	g_doubleBuffer = false;
+	InitWorkerPool(oldThreads);
+}
+
+// Replicate the sim to an in-process client whose acks come back a few ticks late, checking every decoded
+// tick against the encoder's snapshot. Build with PROFILE=large NODES=262144 for the 256K numbers.
+void testReplication()
+{
+	const uint numTicks = 1500;
+	const uint ackDelay = 3; // Ticks
+	static ReplicationEncoder s_encoder;
+	static ReplicationDecoder s_decoder;
+	unsigned char* packet = new unsigned char[MaxReplicationPacketSize()];
+	uint64 totalBytes = 0;
+	uint mismatches = 0;
+
+	InitSimulation();
+	InitReplicationEncoder(&s_encoder);
+	InitReplicationDecoder(&s_decoder);
+	ResetProfiler();
+
+	for (uint tick = 0; tick < numTicks; tick++)
+	{
+		const ReplicationSnapshot* decoded = nullptr;
+		uint size = 0;
+
+		Update(0.016);
+
+		BeginPhase(PHASE_REPLICATION_ENCODE);
+		HRESULT hr = EncodeReplication(&s_encoder, tick, packet, MaxReplicationPacketSize(), &size);
+		EndPhase(PHASE_REPLICATION_ENCODE);
+		AddToCounter(COUNTER_REPLICATION_BYTES, size);
+		totalBytes += size;
+
+		BeginPhase(PHASE_REPLICATION_DECODE);
+		if (SUCCEEDED(hr))
+			hr = DecodeReplication(&s_decoder, packet, size, &decoded);
+		EndPhase(PHASE_REPLICATION_DECODE);
+
+		// The same packet cut short has to fail without touching what the whole one decoded
+		const ReplicationSnapshot* truncated = nullptr;
+		if (SUCCEEDED(hr) && SUCCEEDED(DecodeReplication(&s_decoder, packet, size - 1, &truncated)))
+			hr = E_FAIL;
+
+		const ReplicationSnapshot& sent = s_encoder.snapshots[tick % REPLICATION_HISTORY];
+		if (FAILED(hr) || decoded->tick != tick || decoded->numLinks != sent.numLinks || decoded->endgame != sent.endgame ||
+			memcmp(decoded->position, sent.position, sizeof(sent.position)) != 0 ||
+			memcmp(s_decoder.links, g_links, 2 * sent.numLinks * sizeof(NodeIndex)) != 0)
+		{
+			mismatches++;
+		}
+
+		if (tick >= ackDelay)
+			AckReplication(&s_encoder, tick - ackDelay);
+	}
+
+	printf("%u nodes: %.0f bytes per tick (%.2f per node, raw positions and attribs are %u), %u ticks decoded wrong\n",
+		   g_numNodes, double(totalBytes) / numTicks, double(totalBytes) / numTicks / g_numNodes,
+		   uint(sizeof(short2) + sizeof(Attribs)), mismatches);
+	PrintProfile(stdout, "Replication Test");
+	delete[] packet;
+}
+
+// Record a run through an explosion, replay it from the start, then seek around in it. StepReplay checks the
+// keyframe checksums itself, this checks every tick against the recorded run.
+void testRecordReplay()
+{
+	const uint numTicks = 1500;
+	const uint keyframeInterval = 250;
+	const uint seekTicks[] = { 1000, 1499, 250, 0, 1500 };
+	const char* path = "flowsnake_test.rec";
+	static uint64 s_checksums[numTicks + 1];
+	Replay replay;
+	uint mismatches = 0;
+	HRESULT hr;
+
+	g_doubleBuffer = true; // So the workers can't change the results
+	InitSimulation();
+	ResetProfiler();
+	hr = BeginRecording(path, keyframeInterval);
+	for (uint tick = 0; tick < numTicks && SUCCEEDED(hr); tick++)
+	{
+		s_checksums[tick] = StateChecksum();
+		hr = RecordTick(0.016);
+		Update(0.016);
+	}
+	s_checksums[numTicks] = StateChecksum();
+	if (SUCCEEDED(hr))
+		hr = EndRecording();
+	PrintProfile(stdout, "Recording");
+	if (FAILED(hr))
+	{
+		printf("Recording to %s failed\n", path);
+		g_doubleBuffer = false;
+		return;
+	}
+
+	InitSimulation(); // Forget everything, the replay has to bring it all back
+	ResetProfiler();
+	hr = OpenReplay(&replay, path);
+	while (hr == S_OK)
+	{
+		hr = StepReplay(&replay);
+		if (StateChecksum() != s_checksums[replay.tick])
+			mismatches++;
+	}
+	printf("Replayed %u of %u ticks, %u differ from the recording%s\n", replay.tick, numTicks, mismatches,
+		   FAILED(hr) ? ", REPLAY FAILED" : "");
+	PrintProfile(stdout, "Replay");
+
+	for (uint seek = 0; seek < countof(seekTicks) && replay.header; seek++)
+	{
+		uint64 start = GetTicks();
+		hr = SeekReplay(&replay, seekTicks[seek]);
+		double ms = double(GetTicks() - start) * 1000.0 / GetTickFrequency();
+		printf("Seek to tick %4u: %6.2f ms, %s\n", seekTicks[seek], ms,
+			   SUCCEEDED(hr) && StateChecksum() == s_checksums[seekTicks[seek]] ? "matches" : "DIFFERS");
+	}
+
+	CloseReplay(&replay);
+	remove(path);
+	g_doubleBuffer = false;
+}
+
+// Philox against the known answers from the Random123 distribution, then RandomPairs against RandomPair,
+// and how long each takes to make a million pairs. Last, InitSimulation has to make the same world again.
+void testRandom()
+{
+	const uint numPairs = 1 << 20;
+	const uint known[3][5] = // seed, stream, index, then the two outputs
+	{
+		{ 0x00000000, 0x00000000, 0x00000000, 0xff1dae59, 0x6cd10df2 },
+		{ 0xffffffff, 0xffffffff, 0xffffffff, 0x2c3f628b, 0xab4fd7ad },
+		{ 0x13198a2e, 0x85a308d3, 0x243f6a88, 0xdd7ce038, 0xf62a4c12 },
+	};
+	float* x = new float[2 * numPairs];
+	float* y = x + numPairs;
+	uint wrong = 0;
+	float sum = 0;
+
+	for (uint i = 0; i < countof(known); i++)
+	{
+		RandomBits bits = Philox(known[i][0], known[i][1], known[i][2]);
+		if (bits.x != known[i][3] || bits.y != known[i][4])
+			wrong++;
+	}
+	printf("Philox2x32-10 known answers: %s\n", wrong ? "WRONG" : "match");
+
+	uint64 start = GetTicks();
+	for (uint i = 0; i < numPairs; i++)
+	{
+		RandomPair(g_randomSeed, RandomStream(RANDOM_TEST, 0), i, &x[i], &y[i]);
+		sum += x[i]; // So the loop isn't all dead stores
+	}
+	double scalarMs = double(GetTicks() - start) * 1000.0 / GetTickFrequency();
+
+	start = GetTicks();
+	RandomPairs(g_randomSeed, RandomStream(RANDOM_TEST, 0), 0, numPairs, x, y);
+	double batchMs = double(GetTicks() - start) * 1000.0 / GetTickFrequency();
+
+	wrong = 0;
+	for (uint i = 0; i < numPairs; i += 997) // Odd steps, so every lane gets checked
+	{
+		float pairX, pairY;
+		RandomPair(g_randomSeed, RandomStream(RANDOM_TEST, 0), i, &pairX, &pairY);
+		if (pairX != x[i] || pairY != y[i])
+			wrong++;
+	}
+	printf("%u random pairs: %.2f ms one at a time, %.2f ms %u at a time, %s (mean %.4f)\n", numPairs, scalarMs, batchMs,
+		   UINTV_WIDTH, wrong ? "DIFFERENT" : "same numbers", sum / numPairs);
+	delete[] x;
+
+	InitSimulation();
+	uint64 world = StateChecksum();
+	Update(0.016);
+	InitSimulation();
+	printf("Same seed after another InitSimulation: %s world\n", StateChecksum() == world ? "same" : "DIFFERENT");
+}
+
+// Let's set up a reproduceable test environment...
+// Pass a thread count to test the worker pool, the default is single threaded
+int testMain (int argc, char* argv[])
+{
+	InitWorkerPool(argc > 1 ? atoi(argv[1]) : 1);
+
+	testFirstUpdate();
+	testChainOrder();
+	testGridLayouts();
+	testSearchScheduling();
+	testTailEngines();
+	testMortonLayout();
+	testFallbackSearch();
+	testDoubleBuffer();
+	testReplication();
+	testRecordReplay();
+	testRandom();
+	//testSim();
+
+	ShutdownWorkerPool();
+	return 0;
+}
+
+#ifndef _WIN32
+int main(int argc, char* argv[])
+{
+	return testMain(argc, argv);
+}
+#endif
\ No newline at end of file
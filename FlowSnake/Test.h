@@ -1,15 +1,8 @@
-#pragma once
-
-struct Counter 
-{
-	LARGE_INTEGER start;
-	LARGE_INTEGER end;
-};
-
-extern Counter nearestNeighborCounter;
-extern Counter binningCounter;
-extern Counter positionUpdate;
-
-inline void BeginCounter(Counter* counter);
-inline void EndCounter(Counter* counter);
-double GetCounter(Counter& counter);
\ No newline at end of file
+#pragma once
+
+// Reproducible performance tests, built into the Test configuration (entry point testMain).
+// Timing comes from the phase profiler (Profiler.h), so these report p50/p99/max per phase.
+
+void testFirstUpdate();
+void testSim();
+int testMain(int argc, char* argv[]);
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "WorkerPool.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#define MAX_WORKERS 64
+
+struct PoolJob
+{
+	TaskFunc func;
+	void* context;
+	uint count;
+	std::atomic<uint> next; // Next task index to hand out
+	std::atomic<uint> done; // Number of finished tasks
+};
+
+static std::thread s_threads[MAX_WORKERS];
+static uint s_numThreads = 1; // Including the thread calling ParallelFor
+
+static std::mutex s_mutex;
+static std::condition_variable s_wake;	   // Workers wait here for the next job
+static std::condition_variable s_finished; // ParallelFor waits here for the workers
+static PoolJob s_job;
+static uint s_generation = 0; // Bumped for every job so sleeping workers know there's something new
+static uint s_activeWorkers = 0;
+static bool s_quit = false;
+
+static void RunTasks(TaskFunc func, void* context, uint count)
+{
+	uint index;
+	while ((index = s_job.next++) < count)
+	{
+		func(index, context);
+		s_job.done++;
+	}
+}
+
+static void WorkerMain()
+{
+	uint seen = 0;
+
+	for (;;)
+	{
+		TaskFunc func;
+		void* context;
+		uint count;
+		{
+			std::unique_lock<std::mutex> lock(s_mutex);
+			while (!s_quit && s_generation == seen)
+				s_wake.wait(lock);
+			if (s_quit)
+				return;
+
+			// Copy the job under the lock. ParallelFor won't publish another one while we're active.
+			seen = s_generation;
+			func = s_job.func;
+			context = s_job.context;
+			count = s_job.count;
+			s_activeWorkers++;
+		}
+
+		RunTasks(func, context, count);
+
+		{
+			std::lock_guard<std::mutex> lock(s_mutex);
+			s_activeWorkers--;
+		}
+		s_finished.notify_all();
+	}
+}
+
+HRESULT InitWorkerPool(uint numThreads)
+{
+	if (numThreads == 0)
+		numThreads = std::thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1; // hardware_concurrency() is allowed to not know
+	if (numThreads > MAX_WORKERS)
+		numThreads = MAX_WORKERS;
+
+	ShutdownWorkerPool();
+
+	s_quit = false;
+	s_numThreads = numThreads;
+	for (uint i = 1; i < s_numThreads; i++)
+		s_threads[i] = std::thread(WorkerMain);
+
+	return S_OK;
+}
+
+void ShutdownWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		s_quit = true;
+	}
+	s_wake.notify_all();
+
+	for (uint i = 1; i < s_numThreads; i++)
+		s_threads[i].join();
+
+	s_numThreads = 1;
+}
+
+uint GetWorkerCount()
+{
+	return s_numThreads;
+}
+
+void ParallelFor(uint count, TaskFunc func, void* context)
+{
+	if (s_numThreads == 1 || count == 1)
+	{
+		for (uint i = 0; i < count; i++)
+			func(i, context);
+		return;
+	}
+
+	{
+		// Stragglers from the last job must be out of RunTasks before we reset the counters
+		std::unique_lock<std::mutex> lock(s_mutex);
+		while (s_activeWorkers != 0)
+			s_finished.wait(lock);
+
+		s_job.func = func;
+		s_job.context = context;
+		s_job.count = count;
+		s_job.next = 0;
+		s_job.done = 0;
+		s_generation++;
+	}
+	s_wake.notify_all();
+
+	RunTasks(func, context, count);
+
+	std::unique_lock<std::mutex> lock(s_mutex);
+	while (s_job.done != count || s_activeWorkers != 0)
+		s_finished.wait(lock);
+}
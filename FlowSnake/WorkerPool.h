@@ -0,0 +1,16 @@
+#pragma once
+
+// A fixed pool of worker threads for the data parallel parts of Update().
+// ParallelFor hands out task indexes [0, count) to the workers, the calling thread pitches in too,
+// and it returns once every task has run. Without InitWorkerPool everything runs on the caller.
+
+#include "Platform.h"
+
+typedef void (*TaskFunc)(uint index, void* context);
+
+// numThreads counts the calling thread. 0 uses one thread per hardware thread.
+HRESULT InitWorkerPool(uint numThreads);
+void ShutdownWorkerPool();
+
+uint GetWorkerCount();
+void ParallelFor(uint count, TaskFunc func, void* context);